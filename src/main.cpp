@@ -3,35 +3,61 @@
 //
 // A generic initialization procedure for Vulkan follows the following steps.
 //
-// 1. Create a Vulkan instance.
-// 2. Create a rendering surface.
+// 1. Load the Vulkan library and create a Vulkan instance.
+// 2. Create a rendering surface (skipped in headless mode).
 // 3. Select a physical device and find suitable queue families.
-// 4. Create a logical device & queues.
-// 5.
+// 4. Create a logical device & queues (graphics, present, compute, transfer).
+// 5. Create a pipeline cache (restored from the previous run).
+// 6. Create a swapchain (or offscreen images in headless mode).
+// 7. Render frames with N frames in flight (measured with timestamp queries).
 // ... TODO more to be added ...
 //
 // ============================================================================
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #define VK_USE_PLATFORM_WIN32_KHR
+#endif
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <set>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <thread>
 #include <vector>
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // TODO we actually should use vulkan.hpp instead?
+// the functions are loaded at runtime (see VULKAN FUNCTIONS).
+#define VK_NO_PROTOTYPES
 #include <vulkan/vulkan.h>
 
-const std::vector<const char*> VALIDATION_LAYERS = {
-  "VK_LAYER_LUNARG_standard_validation"
-};
+// The layer that implements the validation (replaces the deprecated meta layer
+// VK_LAYER_LUNARG_standard_validation).
+#define VALIDATION_LAYER "VK_LAYER_KHRONOS_validation"
 
-const std::vector<const char*> EXTENSIONS = {
-  VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
+// The instance extensions required to present into a window surface.
+const std::vector<const char*> SURFACE_EXTENSIONS = {
   "VK_KHR_surface",
   "VK_KHR_win32_surface"
 };
@@ -40,23 +66,91 @@ const std::vector<const char*> DEVICE_EXTENSIONS = {
   VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
-#ifdef NDEBUG
-  const bool enabledValidationLayers = false;
-#else
-  const bool enableValidationLayers = true;
-#endif
-
 #define WINDOW_CLASS "window-class"
+#define PIPELINE_CACHE_FILE "pipeline-cache.bin"
+#define CAPABILITY_SNAPSHOT_FILE "capabilities.bin"
+
+#define OFFSCREEN_IMAGE_WIDTH 800
+#define OFFSCREEN_IMAGE_HEIGHT 600
+#define OFFSCREEN_IMAGE_FORMAT VK_FORMAT_R8G8B8A8_UNORM
+
+#define SWAPCHAIN_IMAGE_COUNT 3
+
+#define MAX_FRAMES_IN_FLIGHT 4
+
+// ============================================================================
+
+// The roles for which the application uses device queues.
+enum QueueRole
+{
+  QUEUE_ROLE_GRAPHICS,
+  QUEUE_ROLE_PRESENT,
+  QUEUE_ROLE_COMPUTE,
+  QUEUE_ROLE_TRANSFER,
+  QUEUE_ROLE_COUNT
+};
+
+// A description of a device queue which is used for a queue role.
+struct QueueInfo
+{
+  VkQueue  queue;
+  uint32_t familyIndex;
+  uint32_t queueIndex;
+  float    priority;
+  bool     dedicated;
+};
+
+// A range of device memory sub-allocated from a larger device memory block.
+struct DeviceAllocation
+{
+  VkDeviceMemory memory;
+  VkDeviceSize   offset;
+  VkDeviceSize   size;
+  void*          mapped;
+  uint32_t       memoryType;
+  uint32_t       block;
+  uint32_t       node;
+};
+
+// The resources of a frame that is being recorded on the host or executed on
+// the device. Each frame in flight owns its own set of these resources (and
+// its own command pools, see COMMAND POOLS).
+struct Frame
+{
+  uint64_t    timelineValue;
+  VkSemaphore acquireSemaphore;
+};
+
+// A swapchain that was replaced by a recreation, but whose images may still be
+// used by the frames in flight until the graphics timeline reaches its value.
+struct RetiredSwapchain
+{
+  VkSwapchainKHR           swapchain;
+  std::vector<VkImageView> imageViews;
+  std::vector<VkSemaphore> presentSemaphores;
+  uint64_t                 timelineValue;
+};
 
 // ============================================================================
 
+#ifdef _WIN32
 // The handle for the main window of the application.
 static HWND sHWND = nullptr;
+// Whether to run without a window and a surface.
+static bool sHeadless = false;
+#else
+// Whether to run without a window and a surface (always without a window).
+static bool sHeadless = true;
+#endif
 
 // The main handle which is used to store all per-application state values.
 static VkInstance sInstance = VK_NULL_HANDLE;
 // A handle that points to the selected physical graphics card.
 static VkPhysicalDevice sPhysicalDevice = VK_NULL_HANDLE;
+// The properties of the selected physical graphics card.
+static VkPhysicalDeviceProperties sPhysicalDeviceProperties = {};
+// The memory properties of the selected physical graphics card.
+static VkPhysicalDeviceMemoryProperties sPhysicalDeviceMemoryProperties = {};
 // The index of the selected physical device queue family for graphics.
 static int sGraphicsQueueFamilyIndex = 0;
 // The index of the selected physical device queue family for presentation.
@@ -65,275 +159,6816 @@ static int sPresentQueueFamilyIndex = 0;
 static VkDevice sLogicalDevice = VK_NULL_HANDLE;
 // A handle to created window surface.
 static VkSurfaceKHR sSurface = VK_NULL_HANDLE;
-// A handle to presentation queue.
-static VkQueue sPresentQueue = VK_NULL_HANDLE;
+// The registry of device queues for each of the queue roles.
+static QueueInfo sQueues[QUEUE_ROLE_COUNT] = {};
+// The priorities of the device queues for each of the queue roles.
+static float sQueuePriorities[QUEUE_ROLE_COUNT] = { 1.f, 1.f, 0.5f, 0.5f };
+// A handle to the pipeline cache shared by all pipeline creations.
+static VkPipelineCache sPipelineCache = VK_NULL_HANDLE;
+// The images used as render targets instead of a swapchain in headless mode.
+static std::vector<VkImage> sOffscreenImages;
+// The device memory of the offscreen images.
+static std::vector<DeviceAllocation> sOffscreenImageMemories;
+// The image views of the offscreen images.
+static std::vector<VkImageView> sOffscreenImageViews;
+// A handle to the swapchain used to present into the window surface.
+static VkSwapchainKHR sSwapchain = VK_NULL_HANDLE;
+// The images owned by the swapchain.
+static std::vector<VkImage> sSwapchainImages;
+// The image views of the swapchain images.
+static std::vector<VkImageView> sSwapchainImageViews;
+// The format of the swapchain images.
+static VkSurfaceFormatKHR sSwapchainFormat = {};
+// The size of the swapchain images.
+static VkExtent2D sSwapchainExtent = {};
+// The presentation mode of the swapchain.
+static VkPresentModeKHR sSwapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+// Whether the swapchain must be recreated (e.g. after the window was resized).
+static bool sSwapchainOutOfDate = false;
+// Whether the window is minimized, in which case there is nothing to present.
+static bool sWindowMinimized = false;
+// The semaphores signaled when the rendering into a swapchain image is done.
+static std::vector<VkSemaphore> sPresentSemaphores;
+// The replaced swapchains which are released once the device is done with them.
+static std::vector<RetiredSwapchain> sRetiredSwapchains;
+// The resources of each frame in flight.
+static Frame sFrames[MAX_FRAMES_IN_FLIGHT] = {};
+// The amount of frames that can be in flight at the same time.
+static uint32_t sFramesInFlight = 2;
+// The amount of frames rendered so far.
+static uint64_t sFrameNumber = 0;
+// The amount of frames to render before exiting or zero for no limit.
+static uint64_t sFrameLimit = 0;
+// The user requested presentation mode or VK_PRESENT_MODE_MAX_ENUM_KHR if none.
+static VkPresentModeKHR sPresentModeOverride = VK_PRESENT_MODE_MAX_ENUM_KHR;
+// Whether the VK_EXT_calibrated_timestamps device extension is enabled.
+static bool sCalibratedTimestamps = false;
+
+// Whether to run the device memory allocation benchmark and exit.
+static bool sBenchDeviceMemory = false;
+// Whether to run the command recording benchmark and exit.
+static bool sBenchRecording = false;
+#ifdef NDEBUG
+// Whether to request the validation layer (disabled in release builds).
+static bool sUseValidation = false;
+#else
+// Whether to request the validation layer (enabled in debug builds).
+static bool sUseValidation = true;
+#endif
+// Whether to request the best practices checks of the validation layer.
+static bool sUseBestPractices = false;
+// The user requested instance layers in addition to the validation layer.
+static std::vector<std::string> sRequestedLayers;
+// The user requested instance extensions in addition to the required ones.
+static std::vector<std::string> sRequestedInstanceExtensions;
+// The instance layers that were available and enabled.
+static std::vector<const char*> sEnabledLayers;
+// The instance extensions that were available and enabled.
+static std::vector<const char*> sEnabledInstanceExtensions;
+// Whether the validation layer and the debug utils extension are enabled.
+static bool sValidationEnabled = false;
+// Whether the best practices checks are enabled with VK_EXT_validation_features.
+static bool sBestPracticesEnabled = false;
+// The user requested physical device (an index or a part of the name).
+static std::string sDeviceOverride;
+
+// The moment when the application was started.
+static std::chrono::steady_clock::time_point sStartupTime;
+
+// ============================================================================
+// LOG
+// ============================================================================
+// All of the output of the application is written through the log, which
+// keeps the console I/O away from the threads that produce the messages.
+//
+// Each thread formats its messages into its own ring buffer, which has only a
+// single producer (the thread) and a single consumer (the flusher thread), so
+// a message is published with an atomic store and without any locks. The
+// flusher thread drains the rings periodically or when woken up, orders the
+// drained messages by their timestamps and writes them out at once. A thread
+// may also capture its messages, e.g. to keep the messages of a concurrent task
+// together, and write them out later.
+//
+//   DEBUG     Detailed listings, e.g. each of the extensions or queue families.
+//   INFO      The progress of the application and the statistics.
+//   WARNING   Something is not available and a fallback is used instead.
+//   ERROR     Something has failed, which is usually followed by an exit.
+//
+// The messages below LOG_LEVEL are removed at compile time. It defaults to INFO
+// with NDEBUG and to DEBUG otherwise, e.g. -DLOG_LEVEL=LOG_LEVEL_WARNING. The
+// rings are never overwritten, so a producer with a full ring waits for the
+// flusher and an error is waited until it has been written out.
+// ============================================================================
+
+#define LOG_LEVEL_DEBUG   0
+#define LOG_LEVEL_INFO    1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR   3
+
+#ifndef LOG_LEVEL
+#ifdef NDEBUG
+#define LOG_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+#define LOG_RING_CAPACITY 128
+#define LOG_MESSAGE_SIZE 240
+#define LOG_FLUSH_INTERVAL_MS 10
+
+#if defined(__GNUC__) && !defined(_WIN32)
+#define LOG_FORMAT(formatIndex, argumentIndex) __attribute__((format(printf, formatIndex, argumentIndex)))
+#else
+#define LOG_FORMAT(formatIndex, argumentIndex)
+#endif
+
+#define LOG_DEBUG(...)   do { if (LOG_LEVEL <= LOG_LEVEL_DEBUG)   log_message(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (false)
+#define LOG_INFO(...)    do { if (LOG_LEVEL <= LOG_LEVEL_INFO)    log_message(LOG_LEVEL_INFO, __VA_ARGS__); } while (false)
+#define LOG_WARNING(...) do { if (LOG_LEVEL <= LOG_LEVEL_WARNING) log_message(LOG_LEVEL_WARNING, __VA_ARGS__); } while (false)
+#define LOG_ERROR(...)   do { if (LOG_LEVEL <= LOG_LEVEL_ERROR)   log_message(LOG_LEVEL_ERROR, __VA_ARGS__); } while (false)
+
+// A formatted message in a ring buffer.
+struct LogMessage
+{
+  int64_t  time;
+  int32_t  level;
+  uint32_t length;
+  char     text[LOG_MESSAGE_SIZE];
+};
+
+// A ring buffer of the messages produced by a thread.
+struct LogRing
+{
+  std::atomic<uint64_t> head;
+  std::atomic<uint64_t> tail;
+  std::atomic<bool>     owned;
+  LogRing*              next;
+  LogMessage            messages[LOG_RING_CAPACITY];
+};
+
+// Releases the ring of a thread for other threads when the thread exits.
+struct LogRingOwner
+{
+  LogRing* ring;
+  ~LogRingOwner();
+};
+
+// The list of all of the rings, which are reused by the later threads.
+static std::atomic<LogRing*> sLogRings(nullptr);
+// The ring of the current thread.
+static thread_local LogRing* sLogRing = nullptr;
+// Whether the ring of the current thread has already been released on exit.
+static thread_local bool sLogRingReleased = false;
+// The owner which releases the ring of the current thread.
+static thread_local LogRingOwner sLogRingOwner = { nullptr };
+// The messages of the current thread are captured into this instead of the ring.
+static thread_local std::vector<LogMessage>* sLogCapture = nullptr;
+// Whether the flusher thread is running.
+static std::atomic<bool> sLogRunning(false);
+// The thread which writes out the messages.
+static std::thread sLogFlusher;
+// The mutex and the condition to wake up the flusher thread.
+static std::mutex sLogMutex;
+static std::condition_variable sLogCondition;
+static bool sLogWakeup = false;
+
+// ============================================================================
+
+LogRingOwner::~LogRingOwner()
+{
+  if (ring != nullptr) {
+    ring->owned.store(false, std::memory_order_release);
+  }
+  sLogRing = nullptr;
+  sLogRingReleased = true;
+}
+
+// ============================================================================
+// Get the ring of the current thread, which is either a ring released by an
+// exited thread or a new ring.
+// @returns The ring of the current thread.
+static LogRing* log_ring()
+{
+  if (sLogRing != nullptr) {
+    return sLogRing;
+  }
+
+  LogRing* ring = nullptr;
+  for (auto it = sLogRings.load(std::memory_order_acquire); it != nullptr && ring == nullptr; it = it->next) {
+    auto owned = false;
+    if (it->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+      ring = it;
+    }
+  }
+  if (ring == nullptr) {
+    ring = new LogRing();
+    ring->owned.store(true, std::memory_order_relaxed);
+    ring->next = sLogRings.load(std::memory_order_relaxed);
+    while (!sLogRings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+  }
+
+  // a ring claimed during the exit of the thread is kept until the process exits.
+  sLogRing = ring;
+  if (!sLogRingReleased) {
+    sLogRingOwner.ring = ring;
+  }
+  return ring;
+}
+
+// ============================================================================
+// Wake up the flusher thread to drain the rings.
+static void wake_log_flusher()
+{
+  {
+    std::lock_guard<std::mutex> lock(sLogMutex);
+    sLogWakeup = true;
+  }
+  sLogCondition.notify_one();
+}
+
+// ============================================================================
+// Drain all of the rings and write out the drained messages in the order of
+// their timestamps.
+// @param messages A buffer for the drained messages.
+static void drain_log_rings(std::vector<LogMessage>& messages)
+{
+  messages.clear();
+  for (auto ring = sLogRings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next) {
+    auto tail = ring->tail.load(std::memory_order_relaxed);
+    auto head = ring->head.load(std::memory_order_acquire);
+    for (auto i = tail; i < head; i++) {
+      messages.push_back(ring->messages[i % LOG_RING_CAPACITY]);
+    }
+    ring->tail.store(head, std::memory_order_release);
+  }
+  if (messages.empty()) {
+    return;
+  }
+
+  std::stable_sort(messages.begin(), messages.end(), [](const LogMessage& a, const LogMessage& b) {
+    return a.time < b.time;
+  });
+  std::string output;
+  for (const auto& message : messages) {
+    output.append(message.text, message.length);
+  }
+  fwrite(output.data(), 1, output.size(), stdout);
+  fflush(stdout);
+}
+
+// ============================================================================
+// The function of the flusher thread.
+static void log_flusher()
+{
+  std::vector<LogMessage> messages;
+  std::unique_lock<std::mutex> lock(sLogMutex);
+  while (sLogRunning.load(std::memory_order_relaxed)) {
+    sLogCondition.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS), [] { return sLogWakeup; });
+    sLogWakeup = false;
+    lock.unlock();
+    drain_log_rings(messages);
+    lock.lock();
+  }
+}
+
+// ============================================================================
+// Format a message and stamp it with the current time.
+// @param message The message to be filled.
+// @param level The severity level of the message.
+// @param format The printf format of the message.
+// @param arguments The arguments of the format.
+static void format_log_message(LogMessage& message, int level, const char* format, va_list arguments)
+{
+  auto length = vsnprintf(message.text, LOG_MESSAGE_SIZE, format, arguments);
+  if (length < 0) {
+    length = 0;
+  } else if (length >= LOG_MESSAGE_SIZE) {
+    // keep a line break at the end of a truncated message.
+    length = LOG_MESSAGE_SIZE - 1;
+    message.text[length - 1] = '\n';
+  }
+  message.length = static_cast<uint32_t>(length);
+  message.level = level;
+  message.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ============================================================================
+// Write a message into the ring of the current thread. The messages are
+// written directly when the flusher thread is not running.
+// @param level The severity level of the message.
+// @param format The printf format of the message.
+static void log_message(int level, const char* format, ...) LOG_FORMAT(2, 3);
+static void log_message(int level, const char* format, ...)
+{
+  va_list arguments;
+  va_start(arguments, format);
+  // the errors are never captured, as an exit usually follows.
+  if (sLogCapture != nullptr && level < LOG_LEVEL_ERROR) {
+    sLogCapture->emplace_back();
+    format_log_message(sLogCapture->back(), level, format, arguments);
+    va_end(arguments);
+    return;
+  }
+  if (!sLogRunning.load(std::memory_order_acquire)) {
+    vprintf(format, arguments);
+    va_end(arguments);
+    return;
+  }
+
+  // wait for the flusher thread if the ring is full.
+  auto ring = log_ring();
+  auto head = ring->head.load(std::memory_order_relaxed);
+  while (head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_CAPACITY) {
+    wake_log_flusher();
+    std::this_thread::yield();
+  }
+
+  format_log_message(ring->messages[head % LOG_RING_CAPACITY], level, format, arguments);
+  va_end(arguments);
+  ring->head.store(head + 1, std::memory_order_release);
+
+  // errors are written out before continuing, as an exit usually follows.
+  if (level >= LOG_LEVEL_ERROR) {
+    wake_log_flusher();
+    while (ring->tail.load(std::memory_order_acquire) <= head && sLogRunning.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  } else if (level >= LOG_LEVEL_WARNING || head + 1 - ring->tail.load(std::memory_order_relaxed) >= LOG_RING_CAPACITY / 2) {
+    wake_log_flusher();
+  }
+}
+
+// ============================================================================
+// Write out the captured messages in the order in which they were captured.
+// @param messages The captured messages.
+static void log_captured_messages(const std::vector<LogMessage>& messages)
+{
+  for (const auto& message : messages) {
+    log_message(message.level, "%.*s", static_cast<int>(message.length), message.text);
+  }
+}
+
+// ============================================================================
+// A scope in which the messages of the current thread are captured instead of
+// written out, so that the messages of the concurrent tasks can be written out
+// later without interleaving them.
+class LogCapture
+{
+public:
+  explicit LogCapture(std::vector<LogMessage>& messages) : mPrevious(sLogCapture) { sLogCapture = &messages; }
+  ~LogCapture() { sLogCapture = mPrevious; }
+private:
+  std::vector<LogMessage>* mPrevious;
+};
+
+// ============================================================================
+// Start the flusher thread, after which the messages are written through it.
+static void start_log()
+{
+  sLogRunning.store(true, std::memory_order_release);
+  sLogFlusher = std::thread(log_flusher);
+}
+
+// ============================================================================
+// Stop the flusher thread and write out all of the remaining messages.
+static void stop_log()
+{
+  if (!sLogRunning.load(std::memory_order_acquire)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(sLogMutex);
+    sLogRunning.store(false, std::memory_order_release);
+    sLogWakeup = true;
+  }
+  sLogCondition.notify_one();
+  sLogFlusher.join();
+
+  std::vector<LogMessage> messages;
+  drain_log_rings(messages);
+}
+
+static int job_worker_index();
+
+// ============================================================================
+// Exit the process after a fatal error. The exit handlers destroy the job
+// system, which the main thread may still be using while a job worker fails,
+// so a job worker exits without them. The error message has already been
+// written out, as the log waits for the flusher after an error.
+[[noreturn]] static void exit_failure()
+{
+  if (job_worker_index() > 0) {
+    fflush(stdout);
+    _Exit(EXIT_FAILURE);
+  }
+  exit(EXIT_FAILURE);
+}
+
+// ============================================================================
+// VULKAN FUNCTIONS
+// ============================================================================
+// The Vulkan library is loaded dynamically at startup instead of linking with
+// it and the functions are resolved into the function tables below.
+//
+// The functions exported by the loader are trampolines, which look up the
+// dispatch table of the instance or the device behind the handle and jump into
+// the implementation. The functions resolved with vkGetDeviceProcAddr instead
+// point directly to the driver (or the first enabled layer), which removes the
+// indirection from each command recording, submit and fence call.
+//
+//   global      vkGetInstanceProcAddr(NULL, name)       when the library is loaded.
+//   instance    vkGetInstanceProcAddr(instance, name)   when an instance is created.
+//   device      vkGetDeviceProcAddr(device, name)       when a device is created.
+//
+// The extension functions are left NULL when the extension is not enabled (or
+// the API version is too old for them) and the optional global functions when
+// the loader is too old to provide them.
+// ============================================================================
+
+#define VULKAN_GLOBAL_FUNCTIONS(X) \
+  X(vkCreateInstance) \
+  X(vkEnumerateInstanceExtensionProperties) \
+  X(vkEnumerateInstanceLayerProperties)
+
+#define VULKAN_GLOBAL_OPTIONAL_FUNCTIONS(X) \
+  X(vkEnumerateInstanceVersion)
+
+#define VULKAN_INSTANCE_FUNCTIONS(X) \
+  X(vkCreateDevice) \
+  X(vkDestroyInstance) \
+  X(vkEnumerateDeviceExtensionProperties) \
+  X(vkEnumeratePhysicalDevices) \
+  X(vkGetDeviceProcAddr) \
+  X(vkGetPhysicalDeviceFeatures) \
+  X(vkGetPhysicalDeviceFormatProperties) \
+  X(vkGetPhysicalDeviceMemoryProperties) \
+  X(vkGetPhysicalDeviceProperties) \
+  X(vkGetPhysicalDeviceQueueFamilyProperties)
+
+#ifdef _WIN32
+#define VULKAN_PLATFORM_INSTANCE_EXTENSION_FUNCTIONS(X) \
+  X(vkCreateWin32SurfaceKHR)
+#else
+#define VULKAN_PLATFORM_INSTANCE_EXTENSION_FUNCTIONS(X)
+#endif
+
+#define VULKAN_INSTANCE_EXTENSION_FUNCTIONS(X) \
+  X(vkCreateDebugUtilsMessengerEXT) \
+  X(vkDestroyDebugUtilsMessengerEXT) \
+  X(vkDestroySurfaceKHR) \
+  X(vkGetPhysicalDeviceCalibrateableTimeDomainsEXT) \
+  X(vkGetPhysicalDeviceFeatures2) \
+  X(vkGetPhysicalDeviceSurfaceCapabilitiesKHR) \
+  X(vkGetPhysicalDeviceSurfaceFormatsKHR) \
+  X(vkGetPhysicalDeviceSurfacePresentModesKHR) \
+  X(vkGetPhysicalDeviceSurfaceSupportKHR) \
+  VULKAN_PLATFORM_INSTANCE_EXTENSION_FUNCTIONS(X)
+
+#define VULKAN_DEVICE_FUNCTIONS(X) \
+  X(vkAllocateCommandBuffers) \
+  X(vkAllocateMemory) \
+  X(vkBeginCommandBuffer) \
+  X(vkBindImageMemory) \
+  X(vkCmdClearColorImage) \
+  X(vkCmdExecuteCommands) \
+  X(vkCmdPipelineBarrier) \
+  X(vkCmdResetQueryPool) \
+  X(vkCmdSetBlendConstants) \
+  X(vkCmdSetScissor) \
+  X(vkCmdSetViewport) \
+  X(vkCmdWriteTimestamp) \
+  X(vkCreateCommandPool) \
+  X(vkCreateFence) \
+  X(vkCreateImage) \
+  X(vkCreateImageView) \
+  X(vkCreatePipelineCache) \
+  X(vkCreateQueryPool) \
+  X(vkCreateSemaphore) \
+  X(vkDestroyCommandPool) \
+  X(vkDestroyDevice) \
+  X(vkDestroyFence) \
+  X(vkDestroyImage) \
+  X(vkDestroyImageView) \
+  X(vkDestroyPipelineCache) \
+  X(vkDestroyQueryPool) \
+  X(vkDestroySemaphore) \
+  X(vkDeviceWaitIdle) \
+  X(vkEndCommandBuffer) \
+  X(vkFreeMemory) \
+  X(vkGetDeviceQueue) \
+  X(vkGetFenceStatus) \
+  X(vkGetImageMemoryRequirements) \
+  X(vkGetPipelineCacheData) \
+  X(vkGetQueryPoolResults) \
+  X(vkMapMemory) \
+  X(vkQueueSubmit) \
+  X(vkResetCommandPool) \
+  X(vkResetFences) \
+  X(vkUnmapMemory) \
+  X(vkWaitForFences)
+
+#define VULKAN_DEVICE_EXTENSION_FUNCTIONS(X) \
+  X(vkAcquireNextImageKHR) \
+  X(vkCreateSwapchainKHR) \
+  X(vkDestroySwapchainKHR) \
+  X(vkGetCalibratedTimestampsEXT) \
+  X(vkGetSemaphoreCounterValue) \
+  X(vkGetSwapchainImagesKHR) \
+  X(vkQueuePresentKHR) \
+  X(vkQueueSubmit2) \
+  X(vkWaitSemaphores)
+
+#define VULKAN_DEFINE_FUNCTION(name) static PFN_##name name = NULL;
+#define VULKAN_RESET_FUNCTION(name) name = NULL;
+
+// The handle of the dynamically loaded Vulkan library.
+#ifdef _WIN32
+static HMODULE sVulkanLibrary = NULL;
+#else
+static void* sVulkanLibrary = NULL;
+#endif
+
+// The entry point of the library used to resolve all of the other functions.
+static PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr = NULL;
+VULKAN_GLOBAL_FUNCTIONS(VULKAN_DEFINE_FUNCTION)
+VULKAN_GLOBAL_OPTIONAL_FUNCTIONS(VULKAN_DEFINE_FUNCTION)
+VULKAN_INSTANCE_FUNCTIONS(VULKAN_DEFINE_FUNCTION)
+VULKAN_INSTANCE_EXTENSION_FUNCTIONS(VULKAN_DEFINE_FUNCTION)
+VULKAN_DEVICE_FUNCTIONS(VULKAN_DEFINE_FUNCTION)
+VULKAN_DEVICE_EXTENSION_FUNCTIONS(VULKAN_DEFINE_FUNCTION)
+
+// ============================================================================
+// Ensure that a required Vulkan function was found.
+// @param function The resolved function or NULL if it was not found.
+// @param name The name of the function.
+// @returns The resolved function.
+static PFN_vkVoidFunction require_vulkan_function(PFN_vkVoidFunction function, const char* name)
+{
+  if (function == NULL) {
+    LOG_ERROR("Unable to find the Vulkan function %s.\n", name);
+    exit_failure();
+  }
+  return function;
+}
+
+#define VULKAN_LOAD_GLOBAL_FUNCTION(name) \
+  name = (PFN_##name) require_vulkan_function(vkGetInstanceProcAddr(NULL, #name), #name);
+#define VULKAN_LOAD_GLOBAL_OPTIONAL_FUNCTION(name) \
+  name = (PFN_##name) vkGetInstanceProcAddr(NULL, #name);
+#define VULKAN_LOAD_INSTANCE_FUNCTION(name) \
+  name = (PFN_##name) require_vulkan_function(vkGetInstanceProcAddr(sInstance, #name), #name);
+#define VULKAN_LOAD_INSTANCE_EXTENSION_FUNCTION(name) \
+  name = (PFN_##name) vkGetInstanceProcAddr(sInstance, #name);
+#define VULKAN_LOAD_DEVICE_FUNCTION(name) \
+  name = (PFN_##name) require_vulkan_function(vkGetDeviceProcAddr(sLogicalDevice, #name), #name);
+#define VULKAN_LOAD_DEVICE_EXTENSION_FUNCTION(name) \
+  name = (PFN_##name) vkGetDeviceProcAddr(sLogicalDevice, #name);
+
+// ============================================================================
+// Load the Vulkan library and resolve the global functions. The library stays
+// loaded between the repeated initializations of the startup benchmark.
+static void load_vulkan_library()
+{
+  if (sVulkanLibrary != NULL) {
+    return;
+  }
+
+#ifdef _WIN32
+  sVulkanLibrary = LoadLibrary("vulkan-1.dll");
+  if (sVulkanLibrary != NULL) {
+    auto function = (PFN_vkVoidFunction) GetProcAddress(sVulkanLibrary, "vkGetInstanceProcAddr");
+    vkGetInstanceProcAddr = (PFN_vkGetInstanceProcAddr) function;
+  }
+#else
+  sVulkanLibrary = dlopen("libvulkan.so.1", RTLD_NOW | RTLD_LOCAL);
+  if (sVulkanLibrary == NULL) {
+    sVulkanLibrary = dlopen("libvulkan.so", RTLD_NOW | RTLD_LOCAL);
+  }
+  if (sVulkanLibrary != NULL) {
+    vkGetInstanceProcAddr = (PFN_vkGetInstanceProcAddr) dlsym(sVulkanLibrary, "vkGetInstanceProcAddr");
+  }
+#endif
+  if (sVulkanLibrary == NULL) {
+    LOG_ERROR("Unable to load the Vulkan library.\n");
+    exit_failure();
+  }
+  require_vulkan_function((PFN_vkVoidFunction) vkGetInstanceProcAddr, "vkGetInstanceProcAddr");
+
+  VULKAN_GLOBAL_FUNCTIONS(VULKAN_LOAD_GLOBAL_FUNCTION)
+  VULKAN_GLOBAL_OPTIONAL_FUNCTIONS(VULKAN_LOAD_GLOBAL_OPTIONAL_FUNCTION)
+  LOG_INFO("Loaded the Vulkan library.\n");
+}
+
+// ============================================================================
+// Resolve the instance functions for the created instance.
+static void load_vulkan_instance_functions()
+{
+  assert(sInstance != VK_NULL_HANDLE);
+  VULKAN_INSTANCE_FUNCTIONS(VULKAN_LOAD_INSTANCE_FUNCTION)
+  VULKAN_INSTANCE_EXTENSION_FUNCTIONS(VULKAN_LOAD_INSTANCE_EXTENSION_FUNCTION)
+}
+
+// ============================================================================
+// Resolve the device functions directly from the driver of the created device.
+static void load_vulkan_device_functions()
+{
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+  VULKAN_DEVICE_FUNCTIONS(VULKAN_LOAD_DEVICE_FUNCTION)
+  VULKAN_DEVICE_EXTENSION_FUNCTIONS(VULKAN_LOAD_DEVICE_EXTENSION_FUNCTION)
+}
+
+// ============================================================================
+// Forget the instance and device functions of the destroyed instance.
+static void reset_vulkan_functions()
+{
+  VULKAN_INSTANCE_FUNCTIONS(VULKAN_RESET_FUNCTION)
+  VULKAN_INSTANCE_EXTENSION_FUNCTIONS(VULKAN_RESET_FUNCTION)
+  VULKAN_DEVICE_FUNCTIONS(VULKAN_RESET_FUNCTION)
+  VULKAN_DEVICE_EXTENSION_FUNCTIONS(VULKAN_RESET_FUNCTION)
+}
+
+// ============================================================================
+// Unload the Vulkan library after everything has been destroyed.
+static void unload_vulkan_library()
+{
+  if (sVulkanLibrary == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  FreeLibrary(sVulkanLibrary);
+#else
+  dlclose(sVulkanLibrary);
+#endif
+  sVulkanLibrary = NULL;
+  vkGetInstanceProcAddr = NULL;
+  VULKAN_GLOBAL_FUNCTIONS(VULKAN_RESET_FUNCTION)
+  VULKAN_GLOBAL_OPTIONAL_FUNCTIONS(VULKAN_RESET_FUNCTION)
+}
+
+// ============================================================================
+// Get the result description for the specified Vulkan result code.
+// @param result The target Vulkan result code.
+// @returns A result description as a string.
+static std::string vulkan_result_description(VkResult result)
+{
+  switch (result)
+  {
+    case VK_SUCCESS:
+      return "Command successfully completed.";
+    case VK_INCOMPLETE:
+      return "A return array was too small for the result.";
+    case VK_ERROR_OUT_OF_HOST_MEMORY:
+      return "A host memory allocation has failed.";
+    case VK_ERROR_OUT_OF_DEVICE_MEMORY:
+      return "A device memory allocation has failed.";
+    case VK_ERROR_INITIALIZATION_FAILED:
+      return "Initialization of an object could not be completed.";
+    case VK_ERROR_LAYER_NOT_PRESENT:
+      return "A requested layer is not present or could not be loaded.";
+    case VK_ERROR_EXTENSION_NOT_PRESENT:
+      return "A requested extension is not supported.";
+    case VK_ERROR_INCOMPATIBLE_DRIVER:
+      return "The requested version of Vulkan is not supported by the driver.";
+    default:
+      return "An unknown result code [" + std::to_string(result) + "] occured.";
+  }
+}
+
+// ============================================================================
+// Get the amount of milliseconds elapsed since the specified moment.
+// @param start The moment from which to start measuring.
+// @returns The elapsed time in milliseconds.
+static double milliseconds_since(const std::chrono::steady_clock::time_point& start)
+{
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+// ============================================================================
+// Calculate a FNV-1a hash from the specified data.
+// @param data The data to be hashed.
+// @param size The size of the data in bytes.
+// @returns A 64-bit hash of the data.
+static uint64_t hash_bytes(const uint8_t* data, size_t size)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// ============================================================================
+// FILES
+// ============================================================================
+// Platform specific helpers to read files through memory mappings and to
+// replace files atomically, so that an interrupted write never leaves a
+// partially written file behind.
+// ============================================================================
+
+// A read-only memory mapping of a file.
+struct MappedFile
+{
+  const uint8_t* data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#endif
+};
+
+// ============================================================================
+// Release the memory mapping of a file.
+// @param mappedFile The mapping to be released.
+static void unmap_file(MappedFile& mappedFile)
+{
+#ifdef _WIN32
+  if (mappedFile.data != nullptr) {
+    UnmapViewOfFile(mappedFile.data);
+  }
+  if (mappedFile.mapping != NULL) {
+    CloseHandle(mappedFile.mapping);
+  }
+  if (mappedFile.file != NULL) {
+    CloseHandle(mappedFile.file);
+  }
+#else
+  if (mappedFile.data != nullptr) {
+    munmap(const_cast<uint8_t*>(mappedFile.data), mappedFile.size);
+  }
+#endif
+  mappedFile = {};
+}
+
+// ============================================================================
+// Memory map the specified file for reading.
+// @param path The path to the file.
+// @param mappedFile The mapping to be filled.
+// @returns true if the file exists, is not empty and was mapped.
+static bool map_file(const char* path, MappedFile& mappedFile)
+{
+  mappedFile = {};
+#ifdef _WIN32
+  mappedFile.file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (mappedFile.file == INVALID_HANDLE_VALUE) {
+    mappedFile.file = NULL;
+    return false;
+  }
+  LARGE_INTEGER size;
+  if (GetFileSizeEx(mappedFile.file, &size) && size.QuadPart > 0) {
+    mappedFile.mapping = CreateFileMapping(mappedFile.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappedFile.mapping != NULL) {
+      mappedFile.data = static_cast<const uint8_t*>(MapViewOfFile(mappedFile.mapping, FILE_MAP_READ, 0, 0, 0));
+      mappedFile.size = static_cast<size_t>(size.QuadPart);
+    }
+  }
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    void* data = mmap(NULL, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      mappedFile.data = static_cast<const uint8_t*>(data);
+      mappedFile.size = static_cast<size_t>(info.st_size);
+    }
+  }
+  close(fd);
+#endif
+  if (mappedFile.data == nullptr) {
+    unmap_file(mappedFile);
+    return false;
+  }
+  return true;
+}
+
+// ============================================================================
+// Write the data into a temporary file and then atomically replace the target.
+// @param path The path to the target file.
+// @param data The data to be written.
+// @param size The size of the data in bytes.
+// @returns true if the target file was replaced.
+static bool write_file_atomically(const char* path, const void* data, size_t size)
+{
+  std::string tempPath = std::string(path) + ".tmp";
+#ifdef _WIN32
+  auto file = CreateFile(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    LOG_ERROR("CreateFile: %ld\n", GetLastError());
+    return false;
+  }
+  DWORD written = 0;
+  auto success = WriteFile(file, data, static_cast<DWORD>(size), &written, NULL);
+  success = success && written == size && FlushFileBuffers(file);
+  CloseHandle(file);
+  if (!success) {
+    LOG_ERROR("WriteFile: %ld\n", GetLastError());
+    return false;
+  }
+  if (!MoveFileEx(tempPath.c_str(), path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    LOG_ERROR("MoveFileEx: %ld\n", GetLastError());
+    return false;
+  }
+#else
+  int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG_ERROR("open: %s\n", strerror(errno));
+    return false;
+  }
+  const char* bytes = static_cast<const char*>(data);
+  size_t written = 0;
+  while (written < size) {
+    auto count = write(fd, bytes + written, size - written);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      break;
+    }
+    written += static_cast<size_t>(count);
+  }
+  bool success = written == size && fsync(fd) == 0;
+  close(fd);
+  if (!success) {
+    LOG_ERROR("write: %s\n", strerror(errno));
+    return false;
+  }
+  if (rename(tempPath.c_str(), path) != 0) {
+    LOG_ERROR("rename: %s\n", strerror(errno));
+    return false;
+  }
+#endif
+  return true;
+}
+
+// ============================================================================
+// TRACE
+// ============================================================================
+// The trace records the CPU zones (e.g. initialization phases and the work of
+// each frame) and the GPU zones measured by the GPU profiler and writes them on
+// exit as a Chrome trace event JSON file, which can be opened in Perfetto UI
+// (ui.perfetto.dev) or in chrome://tracing. Tracing is enabled by specifying
+// the target file with --trace=<path> or with SANDBOX_TRACE.
+//
+// Each thread records its events into its own fixed size buffer, so recording
+// an event never takes a lock. The owner thread is the only writer and it
+// publishes the events by a release store of the count. The buffers are kept
+// in a lock-free list, which is only read when the trace is written. When a
+// thread exits, its buffer is released and reused by a later thread, so the
+// short-lived threads share the tracks instead of each adding a new buffer.
+//
+// All events are timed in nanoseconds since the application startup. The GPU
+// timestamps are converted into the same clock by the GPU profiler.
+// ============================================================================
+
+// The maximum amount of events in a single trace buffer.
+#define TRACE_BUFFER_CAPACITY (64 * 1024)
+
+// A complete event (a zone with a beginning and a duration) in the trace.
+struct TraceEvent
+{
+  const char* name;
+  int64_t     begin;
+  int64_t     duration;
+};
+
+// The events recorded by a single thread (or by the GPU).
+struct TraceBuffer
+{
+  std::string           name;
+  uint32_t              threadId;
+  std::atomic<uint32_t> count;
+  std::atomic<uint32_t> dropped;
+  std::atomic<bool>     owned;
+  TraceBuffer*          next;
+  TraceEvent            events[TRACE_BUFFER_CAPACITY];
+};
+
+// Releases the trace buffer of a thread for other threads when the thread exits.
+struct TraceBufferOwner
+{
+  TraceBuffer* buffer;
+  ~TraceBufferOwner();
+};
+
+// Whether the CPU and GPU zones are recorded into a trace.
+static bool sUseTrace = false;
+// The path of the trace file to write on exit.
+static std::string sTracePath;
+// The list of all trace buffers.
+static std::atomic<TraceBuffer*> sTraceBuffers(nullptr);
+// The amount of created trace buffers, which is used as the thread identifier.
+static std::atomic<uint32_t> sTraceBufferCount(0);
+// The trace buffer of the current thread.
+static thread_local TraceBuffer* sTraceBuffer = nullptr;
+// Whether the trace buffer of the current thread has already been released on exit.
+static thread_local bool sTraceBufferReleased = false;
+// The owner which releases the trace buffer of the current thread.
+static thread_local TraceBufferOwner sTraceBufferOwner = { nullptr };
+
+// ============================================================================
+
+TraceBufferOwner::~TraceBufferOwner()
+{
+  if (buffer != nullptr) {
+    buffer->owned.store(false, std::memory_order_release);
+  }
+  sTraceBuffer = nullptr;
+  sTraceBufferReleased = true;
+}
+
+// ============================================================================
+// Get the current time of the trace clock.
+// @returns The time in nanoseconds since the application startup.
+static int64_t trace_now()
+{
+  auto elapsed = std::chrono::steady_clock::now() - sStartupTime;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+// ============================================================================
+// Create a new trace buffer and add it into the list of the trace buffers.
+// @param name The name of the track shown in the trace viewer.
+// @returns The new trace buffer, which is owned by the caller.
+static TraceBuffer* trace_create_buffer(const std::string& name)
+{
+  auto buffer = new TraceBuffer();
+  buffer->name = name;
+  buffer->threadId = sTraceBufferCount++;
+  buffer->owned.store(true, std::memory_order_relaxed);
+  auto head = sTraceBuffers.load();
+  do {
+    buffer->next = head;
+  } while (!sTraceBuffers.compare_exchange_weak(head, buffer));
+  return buffer;
+}
+
+// ============================================================================
+// Get the trace buffer of the current thread, which is either a buffer
+// released by an exited thread or a new buffer.
+// @returns The trace buffer of the current thread.
+static TraceBuffer* trace_thread_buffer()
+{
+  if (sTraceBuffer != nullptr) {
+    return sTraceBuffer;
+  }
+
+  TraceBuffer* buffer = nullptr;
+  for (auto it = sTraceBuffers.load(std::memory_order_acquire); it != nullptr && buffer == nullptr; it = it->next) {
+    auto owned = false;
+    if (it->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+      buffer = it;
+    }
+  }
+  if (buffer == nullptr) {
+    buffer = trace_create_buffer("thread " + std::to_string(sTraceBufferCount.load()));
+  }
+
+  // a buffer claimed during the exit of the thread is kept until the process exits.
+  sTraceBuffer = buffer;
+  if (!sTraceBufferReleased) {
+    sTraceBufferOwner.buffer = buffer;
+  }
+  return buffer;
+}
+
+// ============================================================================
+// Name the trace track of the current thread.
+// @param name The name of the thread.
+static void trace_thread_name(const char* name)
+{
+  if (!sUseTrace) {
+    return;
+  }
+  trace_thread_buffer()->name = name;
+}
+
+// ============================================================================
+// Record a complete event into a trace buffer owned by the calling thread.
+// @param buffer The target trace buffer.
+// @param name The name of the event (must be a string literal).
+// @param begin The beginning of the event in nanoseconds.
+// @param end The end of the event in nanoseconds.
+static void trace_event(TraceBuffer* buffer, const char* name, int64_t begin, int64_t end)
+{
+  auto count = buffer->count.load(std::memory_order_relaxed);
+  if (count == TRACE_BUFFER_CAPACITY) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  auto& event = buffer->events[count];
+  event.name = name;
+  event.begin = begin;
+  event.duration = end - begin;
+  buffer->count.store(count + 1, std::memory_order_release);
+}
+
+// ============================================================================
+// A scoped CPU zone that is recorded into the trace when the scope is exited.
+class TraceZone
+{
+public:
+  explicit TraceZone(const char* name) : mName(name), mBegin(sUseTrace ? trace_now() : 0) {}
+  ~TraceZone()
+  {
+    if (!sUseTrace) {
+      return;
+    }
+    trace_event(trace_thread_buffer(), mName, mBegin, trace_now());
+  }
+private:
+  const char* mName;
+  int64_t     mBegin;
+};
+
+// ============================================================================
+// Write the recorded events as a Chrome trace event JSON file and release the
+// trace buffers. This must be called only after all other threads are done.
+static void write_trace_file()
+{
+  if (!sUseTrace) {
+    return;
+  }
+  sUseTrace = false;
+
+  FILE* file = fopen(sTracePath.c_str(), "w");
+  if (file == NULL) {
+    LOG_ERROR("Unable to open the trace file: %s\n", sTracePath.c_str());
+    return;
+  }
+
+  // the events are written as microseconds, which is the unit of the format.
+  uint64_t eventCount = 0;
+  uint64_t droppedCount = 0;
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"vulkan-sandbox\"}}");
+  auto buffer = sTraceBuffers.exchange(nullptr);
+  while (buffer != nullptr) {
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+      buffer->threadId,
+      buffer->name.c_str());
+    fprintf(file, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}",
+      buffer->threadId,
+      buffer->threadId);
+    auto count = buffer->count.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < count; i++) {
+      const auto& event = buffer->events[i];
+      fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+        event.name,
+        buffer->threadId,
+        event.begin / 1000.0,
+        event.duration / 1000.0);
+    }
+    eventCount += count;
+    droppedCount += buffer->dropped.load();
+
+    auto next = buffer->next;
+    delete buffer;
+    buffer = next;
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  sTraceBuffer = nullptr;
+  sTraceBufferOwner.buffer = nullptr;
+
+  LOG_INFO("Wrote [%llu] trace events into %s (dropped: %llu).\n",
+    static_cast<unsigned long long>(eventCount),
+    sTracePath.c_str(),
+    static_cast<unsigned long long>(droppedCount));
+}
+
+// ============================================================================
+// STARTUP
+// ============================================================================
+// The initialization is split into phases (the initialization tasks), which
+// are timed with the steady clock. Independent phases run concurrently, so the
+// total time of the initialization is usually less than the sum of the phases.
+//
+// With --bench-startup=<K> the Vulkan initialization and the first frame are
+// repeated K times within the process and the min, median and p99 times of the
+// phases are printed. The first run is also shown separately, as it includes
+// one-time costs (e.g. loading the driver) and may start with a cold pipeline
+// cache, while the later runs see the cache saved by the previous run.
+// ============================================================================
+
+// The timings of a single startup phase over all of the runs.
+struct StartupPhase
+{
+  const char*         name;
+  std::vector<double> samples;
+};
+
+// The timings of the startup phases in the order of their first appearance.
+static std::vector<StartupPhase> sStartupPhases;
+// The total initialization time of each run.
+static std::vector<double> sStartupTotals;
+// The moment when the current run was started.
+static std::chrono::steady_clock::time_point sStartupRunTime;
+// The mutex to record the phases from concurrent tasks.
+static std::mutex sStartupMutex;
+// The amount of runs in the startup benchmark or zero to run normally.
+static uint32_t sBenchStartupCount = 0;
+
+// ============================================================================
+
+static void begin_startup_phases()
+{
+  sStartupRunTime = std::chrono::steady_clock::now();
+}
+
+// ============================================================================
+// Record the time spent in a startup phase.
+// @param name The name of the phase (must be a string literal).
+// @param milliseconds The duration of the phase.
+static void startup_phase(const char* name, double milliseconds)
+{
+  std::lock_guard<std::mutex> lock(sStartupMutex);
+  auto it = std::find_if(sStartupPhases.begin(), sStartupPhases.end(), [&](const StartupPhase& phase) {
+    return strcmp(phase.name, name) == 0;
+  });
+  if (it == sStartupPhases.end()) {
+    StartupPhase phase = { name, std::vector<double>() };
+    it = sStartupPhases.insert(sStartupPhases.end(), phase);
+  }
+  it->samples.push_back(milliseconds);
+}
+
+// ============================================================================
+
+static void end_startup_phases()
+{
+  sStartupTotals.push_back(milliseconds_since(sStartupRunTime));
+}
+
+// ============================================================================
+// Get a percentile of the samples with the nearest-rank method.
+// @param samples The samples (must not be empty).
+// @param percentile The percentile in range [0, 100].
+// @returns The sample at the percentile.
+static double startup_percentile(std::vector<double> samples, double percentile)
+{
+  std::sort(samples.begin(), samples.end());
+  auto rank = static_cast<size_t>(percentile / 100.0 * samples.size() + 0.999999);
+  return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// ============================================================================
+// Print the phase timings of the latest run.
+static void print_startup_phases()
+{
+  LOG_INFO("Startup phases (ms):\n");
+  for (const auto& phase : sStartupPhases) {
+    LOG_INFO("\t%-32s %10.3f\n", phase.name, phase.samples.back());
+  }
+  LOG_INFO("\t%-32s %10.3f\n", "total", sStartupTotals.back());
+}
+
+// ============================================================================
+// Print the statistics of the phase timings over all of the runs.
+static void print_startup_benchmark()
+{
+  LOG_INFO("Startup phases over [%d] runs (ms):\n", static_cast<int>(sStartupTotals.size()));
+  LOG_INFO("\t%-32s %10s %10s %10s %10s\n", "phase", "first", "min", "median", "p99");
+  auto print = [](const char* name, const std::vector<double>& samples) {
+    LOG_INFO("\t%-32s %10.3f %10.3f %10.3f %10.3f\n",
+      name,
+      samples.front(),
+      startup_percentile(samples, 0.0),
+      startup_percentile(samples, 50.0),
+      startup_percentile(samples, 99.0));
+  };
+  for (const auto& phase : sStartupPhases) {
+    print(phase.name, phase.samples);
+  }
+  print("total", sStartupTotals);
+}
+
+// ============================================================================
+// HOST MEMORY
+// ============================================================================
+// Vulkan allows the application to provide its own host memory allocator for
+// the driver and the loader with VkAllocationCallbacks. Each allocation comes
+// with an allocation scope, which tells how long the allocation will live.
+//
+// Our host allocator keeps a separate arena for each allocation scope, so that
+// short-lived command allocations never fragment the long-lived device and
+// instance allocations. Each arena is split into power-of-two size classes,
+// where blocks are carved from large chunks and recycled via free lists.
+//
+//   1. Small allocations are served from a per-thread cache without locking.
+//   2. An empty or a full per-thread cache is refilled from or drained into
+//      the shared free list of the size class under a lock.
+//   3. Allocations larger than the largest size class go to the system heap.
+//
+// Every allocation is preceded by a small header, which tells where the block
+// came from. The total amount of reserved memory can be bounded with a budget.
+//
+// The allocator also gathers statistics (allocation counts, live and peak
+// bytes and a histogram of sizes) for each allocation scope and for each named
+// phase of the application (e.g. create_logical_device or render_frame), which
+// helps finding the phases where the driver makes bursts of allocations. The
+// statistics are printed on shutdown and on demand (F1 key with a window).
+// ============================================================================
+
+// The size of the smallest size class as a power of two (32 bytes).
+#define HOST_MIN_SIZE_CLASS_SHIFT 5
+// The amount of size classes (32 bytes ... 8 KiB).
+#define HOST_SIZE_CLASS_COUNT 9
+// The size of the chunks from which the size class blocks are carved.
+#define HOST_CHUNK_SIZE (64 * 1024)
+// The amount of blocks each thread may cache for each size class.
+#define HOST_THREAD_CACHE_SIZE 16
+// The amount of Vulkan system allocation scopes.
+#define HOST_SCOPE_COUNT (VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1)
+// The size class marker for allocations that go to the system heap.
+#define HOST_LARGE_SIZE_CLASS 0xff
+
+// The maximum amount of named phases for the host memory statistics.
+#define HOST_PHASE_COUNT 16
+// The amount of bins in the allocation size histogram (16 bytes ... >64 KiB).
+#define HOST_HISTOGRAM_BIN_COUNT 14
+
+// The alignment of the blocks from the system heap and from the pools.
+#define HOST_BLOCK_ALIGNMENT 16
+
+// A header that precedes each of the host allocations.
+struct alignas(HOST_BLOCK_ALIGNMENT) HostAllocationHeader
+{
+  uint64_t size;
+  uint64_t blockSize;
+  uint32_t offset;
+  uint8_t  sizeClass;
+  uint8_t  scope;
+  uint16_t phase;
+};
+static_assert(sizeof(HostAllocationHeader) % HOST_BLOCK_ALIGNMENT == 0, "host allocation header must keep the block alignment");
+
+// A shared free list of blocks of a single size class.
+struct HostPool
+{
+  std::mutex mutex;
+  void* freeList;
+};
+
+// An arena which owns the chunks and size class pools of an allocation scope.
+struct HostArena
+{
+  std::mutex mutex;
+  std::vector<void*> chunks;
+  HostPool pools[HOST_SIZE_CLASS_COUNT];
+};
+
+// A per-thread cache of free blocks for each scope and size class.
+struct HostThreadCache
+{
+  uint32_t count[HOST_SCOPE_COUNT][HOST_SIZE_CLASS_COUNT];
+  void* blocks[HOST_SCOPE_COUNT][HOST_SIZE_CLASS_COUNT][HOST_THREAD_CACHE_SIZE];
+};
+
+// Returns the thread cache into the shared pools when the thread exits.
+struct HostThreadCacheOwner
+{
+  bool active;
+  ~HostThreadCacheOwner();
+};
+
+// Statistics of host allocations made within a scope or within a phase.
+struct HostStatistics
+{
+  std::atomic<uint64_t> allocationCount;
+  std::atomic<uint64_t> freeCount;
+  std::atomic<uint64_t> liveBytes;
+  std::atomic<uint64_t> peakBytes;
+  std::atomic<uint64_t> internalBytes;
+  std::atomic<uint64_t> histogram[HOST_HISTOGRAM_BIN_COUNT];
+};
+
+// Whether to pass our host allocator to Vulkan instead of the default one.
+static bool sUseHostAllocator = true;
+// The maximum amount of host memory to reserve or zero for no limit.
+static size_t sHostMemoryBudget = 0;
+// The amount of host memory reserved from the system.
+static std::atomic<size_t> sHostMemoryReserved(0);
+// The arenas for each of the allocation scopes.
+static HostArena sHostArenas[HOST_SCOPE_COUNT];
+// The cache of free blocks of the calling thread.
+static thread_local HostThreadCache sHostThreadCache;
+// The owner which returns the cache of the calling thread on exit.
+static thread_local HostThreadCacheOwner sHostThreadCacheOwner = { false };
+// The allocation callbacks which are passed to Vulkan.
+static VkAllocationCallbacks sAllocationCallbacks = {};
+// The host allocation statistics of each allocation scope.
+static HostStatistics sHostScopeStatistics[HOST_SCOPE_COUNT];
+// The host allocation statistics of each named phase.
+static HostStatistics sHostPhaseStatistics[HOST_PHASE_COUNT];
+// The names of the registered phases, where the first one is the default.
+static const char* sHostPhaseNames[HOST_PHASE_COUNT] = { "other" };
+// The amount of registered phases.
+static int sHostPhaseCount = 1;
+// The mutex to register new phases.
+static std::mutex sHostPhaseMutex;
+// The phase to which the host allocations of the calling thread are currently
+// attributed. This is per thread as the initialization tasks run concurrently,
+// so the allocations made by the driver's own threads go to the default phase.
+static thread_local int sHostPhase = 0;
+
+// ============================================================================
+// Get the name of the specified allocation scope.
+// @param scope The target allocation scope.
+// @returns The name of the allocation scope.
+static const char* host_scope_name(int scope)
+{
+  switch (scope)
+  {
+    case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND:
+      return "command";
+    case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT:
+      return "object";
+    case VK_SYSTEM_ALLOCATION_SCOPE_CACHE:
+      return "cache";
+    case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE:
+      return "device";
+    case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE:
+      return "instance";
+    default:
+      return "unknown";
+  }
+}
+
+// ============================================================================
+// Record an allocation into the statistics.
+// @param statistics The target statistics.
+// @param size The size of the allocation in bytes.
+static void host_statistics_allocate(HostStatistics& statistics, size_t size)
+{
+  statistics.allocationCount.fetch_add(1, std::memory_order_relaxed);
+  auto live = statistics.liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+  auto peak = statistics.peakBytes.load(std::memory_order_relaxed);
+  while (live > peak && !statistics.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+  }
+  int bin = 0;
+  while (bin < HOST_HISTOGRAM_BIN_COUNT - 1 && size > (size_t(16) << bin)) {
+    bin++;
+  }
+  statistics.histogram[bin].fetch_add(1, std::memory_order_relaxed);
+}
+
+// ============================================================================
+// Record a release of an allocation into the statistics.
+// @param statistics The target statistics.
+// @param size The size of the allocation in bytes.
+static void host_statistics_free(HostStatistics& statistics, size_t size)
+{
+  statistics.freeCount.fetch_add(1, std::memory_order_relaxed);
+  statistics.liveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+// ============================================================================
+// Find or register a named phase for the host memory statistics.
+// @param name The name of the phase (a string literal).
+// @returns The index of the phase.
+static int host_memory_phase(const char* name)
+{
+  std::lock_guard<std::mutex> lock(sHostPhaseMutex);
+  for (int phase = 0; phase < sHostPhaseCount; phase++) {
+    if (strcmp(sHostPhaseNames[phase], name) == 0) {
+      return phase;
+    }
+  }
+  if (sHostPhaseCount == HOST_PHASE_COUNT) {
+    return 0;
+  }
+  sHostPhaseNames[sHostPhaseCount] = name;
+  return sHostPhaseCount++;
+}
+
+// A helper which attributes host allocations to a phase within a C++ scope.
+class HostMemoryPhase
+{
+public:
+  explicit HostMemoryPhase(const char* name) : mPrevious(sHostPhase) { sHostPhase = host_memory_phase(name); }
+  ~HostMemoryPhase() { sHostPhase = mPrevious; }
+private:
+  int mPrevious;
+};
+
+// ============================================================================
+// Print out the statistics of the specified scope or phase.
+// @param name The name of the scope or phase.
+// @param statistics The target statistics.
+static void print_host_statistics(const char* name, const HostStatistics& statistics)
+{
+  std::string histogram;
+  for (const auto& bin : statistics.histogram) {
+    histogram += " " + std::to_string(static_cast<unsigned long long>(bin.load()));
+  }
+  LOG_INFO("\t%-32s %10llu %10llu %12llu %12llu %12llu |%s\n",
+    name,
+    static_cast<unsigned long long>(statistics.allocationCount.load()),
+    static_cast<unsigned long long>(statistics.freeCount.load()),
+    static_cast<unsigned long long>(statistics.liveBytes.load()),
+    static_cast<unsigned long long>(statistics.peakBytes.load()),
+    static_cast<unsigned long long>(statistics.internalBytes.load()),
+    histogram.c_str());
+}
+
+// ============================================================================
+
+static void dump_host_memory_statistics()
+{
+  if (!sUseHostAllocator) {
+    LOG_INFO("Host memory statistics are only available with the pooled host allocator.\n");
+    return;
+  }
+  LOG_INFO("Host memory statistics (reserved: %llu bytes):\n",
+    static_cast<unsigned long long>(sHostMemoryReserved.load()));
+  LOG_INFO("\t%-32s %10s %10s %12s %12s %12s | %s\n",
+    "scope/phase", "allocs", "frees", "live", "peak", "internal", "histogram (<=16, <=32, ... <=64K, >64K)");
+  for (int scope = 0; scope < HOST_SCOPE_COUNT; scope++) {
+    print_host_statistics(host_scope_name(scope), sHostScopeStatistics[scope]);
+  }
+  for (int phase = 0; phase < sHostPhaseCount; phase++) {
+    std::string name = std::string("phase:") + sHostPhaseNames[phase];
+    print_host_statistics(name.c_str(), sHostPhaseStatistics[phase]);
+  }
+}
+
+// ============================================================================
+// Get the size class for a block of the specified size.
+// @param size The size of the block in bytes.
+// @returns The size class or -1 if the block is too large for the pools.
+static int host_size_class(size_t size)
+{
+  size_t classSize = 1u << HOST_MIN_SIZE_CLASS_SHIFT;
+  for (int sizeClass = 0; sizeClass < HOST_SIZE_CLASS_COUNT; sizeClass++) {
+    if (size <= classSize) {
+      return sizeClass;
+    }
+    classSize <<= 1;
+  }
+  return -1;
+}
+
+// ============================================================================
+// Reserve memory from the system while respecting the host memory budget.
+// @param size The amount of memory to reserve.
+// @returns A pointer to the memory or nullptr if out of memory or budget.
+static void* host_reserve(size_t size)
+{
+  auto reserved = sHostMemoryReserved.fetch_add(size) + size;
+  if (sHostMemoryBudget > 0 && reserved > sHostMemoryBudget) {
+    sHostMemoryReserved.fetch_sub(size);
+    return nullptr;
+  }
+  void* memory = malloc(size);
+  if (memory == nullptr) {
+    sHostMemoryReserved.fetch_sub(size);
+  }
+  return memory;
+}
+
+// ============================================================================
+// Take a block from the shared pool into the thread cache, carving a new chunk
+// into blocks when the pool has run out of free blocks.
+// @param scope The allocation scope of the block.
+// @param sizeClass The size class of the block.
+// @returns true if the thread cache contains blocks afterwards.
+static bool host_refill_thread_cache(int scope, int sizeClass)
+{
+  auto& arena = sHostArenas[scope];
+  auto& pool = arena.pools[sizeClass];
+  auto& count = sHostThreadCache.count[scope][sizeClass];
+  auto blocks = sHostThreadCache.blocks[scope][sizeClass];
+  size_t blockSize = size_t(1) << (sizeClass + HOST_MIN_SIZE_CLASS_SHIFT);
+  sHostThreadCacheOwner.active = true;
+
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  if (pool.freeList == nullptr) {
+    auto chunk = static_cast<uint8_t*>(host_reserve(HOST_CHUNK_SIZE));
+    if (chunk == nullptr) {
+      return false;
+    }
+    {
+      std::lock_guard<std::mutex> arenaLock(arena.mutex);
+      arena.chunks.push_back(chunk);
+    }
+    for (size_t offset = HOST_CHUNK_SIZE; offset >= blockSize; offset -= blockSize) {
+      auto block = chunk + offset - blockSize;
+      *reinterpret_cast<void**>(block) = pool.freeList;
+      pool.freeList = block;
+    }
+  }
+  while (pool.freeList != nullptr && count < HOST_THREAD_CACHE_SIZE / 2) {
+    auto block = pool.freeList;
+    pool.freeList = *reinterpret_cast<void**>(block);
+    blocks[count++] = block;
+  }
+  return count > 0;
+}
+
+// ============================================================================
+// Return the blocks in the thread cache into the shared pool.
+// @param scope The allocation scope of the blocks.
+// @param sizeClass The size class of the blocks.
+// @param keep The amount of blocks to keep in the thread cache.
+static void host_drain_thread_cache(int scope, int sizeClass, uint32_t keep)
+{
+  auto& pool = sHostArenas[scope].pools[sizeClass];
+  auto& count = sHostThreadCache.count[scope][sizeClass];
+  auto blocks = sHostThreadCache.blocks[scope][sizeClass];
+  if (count <= keep) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  while (count > keep) {
+    auto block = blocks[--count];
+    *reinterpret_cast<void**>(block) = pool.freeList;
+    pool.freeList = block;
+  }
+}
+
+// ============================================================================
+
+HostThreadCacheOwner::~HostThreadCacheOwner()
+{
+  // the blocks cached later during the exit of the thread are left unused.
+  for (int scope = 0; scope < HOST_SCOPE_COUNT; scope++) {
+    for (int sizeClass = 0; sizeClass < HOST_SIZE_CLASS_COUNT; sizeClass++) {
+      host_drain_thread_cache(scope, sizeClass, 0);
+    }
+  }
+  active = false;
+}
+
+// ============================================================================
+// VkAllocationCallbacks - Allocate host memory for Vulkan.
+static VKAPI_ATTR void* VKAPI_CALL host_allocate(void* userData,
+                                                 size_t size,
+                                                 size_t alignment,
+                                                 VkSystemAllocationScope allocationScope)
+{
+  (void) userData;
+  if (size == 0) {
+    return nullptr;
+  }
+
+  // reserve space for the header and for the alignment in front of the data.
+  int scope = static_cast<int>(allocationScope);
+  size_t padding = sizeof(HostAllocationHeader) - HOST_BLOCK_ALIGNMENT;
+  padding += std::max<size_t>(alignment, HOST_BLOCK_ALIGNMENT);
+  size_t blockSize = size + padding;
+  int sizeClass = host_size_class(blockSize);
+
+  // take a block from the thread cache or from the system heap.
+  uint8_t* block = nullptr;
+  if (sizeClass < 0) {
+    block = static_cast<uint8_t*>(host_reserve(blockSize));
+  } else {
+    auto& count = sHostThreadCache.count[scope][sizeClass];
+    if (count > 0 || host_refill_thread_cache(scope, sizeClass)) {
+      block = static_cast<uint8_t*>(sHostThreadCache.blocks[scope][sizeClass][--count]);
+    }
+  }
+  if (block == nullptr) {
+    return nullptr;
+  }
+
+  // place the data at the first aligned address after the header.
+  auto address = reinterpret_cast<uintptr_t>(block) + sizeof(HostAllocationHeader);
+  address = (address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+  auto data = reinterpret_cast<uint8_t*>(address);
+
+  HostAllocationHeader header;
+  header.size = size;
+  header.blockSize = sizeClass < 0 ? blockSize : size_t(1) << (sizeClass + HOST_MIN_SIZE_CLASS_SHIFT);
+  header.offset = static_cast<uint32_t>(data - block);
+  header.sizeClass = sizeClass < 0 ? HOST_LARGE_SIZE_CLASS : static_cast<uint8_t>(sizeClass);
+  header.scope = static_cast<uint8_t>(scope);
+  header.phase = static_cast<uint16_t>(sHostPhase);
+  memcpy(data - sizeof(header), &header, sizeof(header));
+
+  host_statistics_allocate(sHostScopeStatistics[header.scope], size);
+  host_statistics_allocate(sHostPhaseStatistics[header.phase], size);
+  return data;
+}
+
+// ============================================================================
+// VkAllocationCallbacks - Free host memory allocated for Vulkan.
+static VKAPI_ATTR void VKAPI_CALL host_free(void* userData, void* memory)
+{
+  (void) userData;
+  if (memory == nullptr) {
+    return;
+  }
+
+  // resolve the block from the header in front of the data.
+  auto data = static_cast<uint8_t*>(memory);
+  HostAllocationHeader header;
+  memcpy(&header, data - sizeof(header), sizeof(header));
+  auto block = data - header.offset;
+  host_statistics_free(sHostScopeStatistics[header.scope], header.size);
+  host_statistics_free(sHostPhaseStatistics[header.phase], header.size);
+
+  // return the block into the thread cache or into the system heap.
+  if (header.sizeClass == HOST_LARGE_SIZE_CLASS) {
+    sHostMemoryReserved.fetch_sub(header.blockSize);
+    free(block);
+    return;
+  }
+  auto& count = sHostThreadCache.count[header.scope][header.sizeClass];
+  if (count == HOST_THREAD_CACHE_SIZE) {
+    host_drain_thread_cache(header.scope, header.sizeClass, HOST_THREAD_CACHE_SIZE / 2);
+  } else if (count == 0) {
+    sHostThreadCacheOwner.active = true;
+  }
+  sHostThreadCache.blocks[header.scope][header.sizeClass][count++] = block;
+}
+
+// ============================================================================
+// VkAllocationCallbacks - Reallocate host memory allocated for Vulkan.
+static VKAPI_ATTR void* VKAPI_CALL host_reallocate(void* userData,
+                                                   void* original,
+                                                   size_t size,
+                                                   size_t alignment,
+                                                   VkSystemAllocationScope allocationScope)
+{
+  if (original == nullptr) {
+    return host_allocate(userData, size, alignment, allocationScope);
+  }
+  if (size == 0) {
+    host_free(userData, original);
+    return nullptr;
+  }
+
+  // keep the block as it is when the new size still fits into it.
+  auto data = static_cast<uint8_t*>(original);
+  HostAllocationHeader header;
+  memcpy(&header, data - sizeof(header), sizeof(header));
+  bool aligned = (reinterpret_cast<uintptr_t>(data) & (alignment - 1)) == 0;
+  if (header.sizeClass != HOST_LARGE_SIZE_CLASS && aligned) {
+    if (header.offset + size <= header.blockSize) {
+      host_statistics_free(sHostScopeStatistics[header.scope], header.size);
+      host_statistics_free(sHostPhaseStatistics[header.phase], header.size);
+      host_statistics_allocate(sHostScopeStatistics[header.scope], size);
+      host_statistics_allocate(sHostPhaseStatistics[header.phase], size);
+      header.size = size;
+      memcpy(data - sizeof(header), &header, sizeof(header));
+      return original;
+    }
+  }
+
+  // otherwise move the data into a new block.
+  void* memory = host_allocate(userData, size, alignment, allocationScope);
+  if (memory == nullptr) {
+    return nullptr;
+  }
+  memcpy(memory, original, std::min<size_t>(size, header.size));
+  host_free(userData, original);
+  return memory;
+}
+
+// ============================================================================
+// VkAllocationCallbacks - Notification of an internal driver allocation.
+static VKAPI_ATTR void VKAPI_CALL host_internal_allocate(void* userData,
+                                                         size_t size,
+                                                         VkInternalAllocationType allocationType,
+                                                         VkSystemAllocationScope allocationScope)
+{
+  (void) userData;
+  (void) allocationType;
+  sHostScopeStatistics[allocationScope].internalBytes.fetch_add(size, std::memory_order_relaxed);
+  sHostPhaseStatistics[sHostPhase].internalBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+// ============================================================================
+// VkAllocationCallbacks - Notification of an internal driver release.
+static VKAPI_ATTR void VKAPI_CALL host_internal_free(void* userData,
+                                                     size_t size,
+                                                     VkInternalAllocationType allocationType,
+                                                     VkSystemAllocationScope allocationScope)
+{
+  (void) userData;
+  (void) allocationType;
+  // phases only accumulate the internal allocations made within the phase.
+  sHostScopeStatistics[allocationScope].internalBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+// ============================================================================
+// Get the allocation callbacks to be passed to Vulkan create/destroy calls.
+// @returns The allocation callbacks or NULL to use the default allocator.
+static const VkAllocationCallbacks* host_allocator()
+{
+  return sUseHostAllocator ? &sAllocationCallbacks : NULL;
+}
+
+// ============================================================================
+
+static void init_host_allocator()
+{
+  sAllocationCallbacks.pUserData = NULL;
+  sAllocationCallbacks.pfnAllocation = host_allocate;
+  sAllocationCallbacks.pfnReallocation = host_reallocate;
+  sAllocationCallbacks.pfnFree = host_free;
+  sAllocationCallbacks.pfnInternalAllocation = host_internal_allocate;
+  sAllocationCallbacks.pfnInternalFree = host_internal_free;
+  if (sUseHostAllocator) {
+    LOG_INFO("Using a pooled host allocator (budget: %d KiB).\n", static_cast<int>(sHostMemoryBudget / 1024));
+  }
+}
+
+// ============================================================================
+// Release all memory of the host allocator. All objects created with the host
+// allocator must have been destroyed and other threads must have exited, which
+// returned their thread caches into the pools.
+static void destroy_host_allocator()
+{
+  // the pools are locked before the arena, like when refilling a thread cache.
+  for (auto& arena : sHostArenas) {
+    for (auto& pool : arena.pools) {
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      pool.freeList = nullptr;
+    }
+    std::lock_guard<std::mutex> arenaLock(arena.mutex);
+    for (auto chunk : arena.chunks) {
+      free(chunk);
+    }
+    sHostMemoryReserved.fetch_sub(arena.chunks.size() * HOST_CHUNK_SIZE);
+    arena.chunks.clear();
+  }
+  memset(&sHostThreadCache, 0, sizeof(sHostThreadCache));
+}
+
+// ============================================================================
+// DEVICE FEATURES
+// ============================================================================
+// The instance is created with the highest API version supported by both the
+// loader and the application, and each device is used with the lower one of
+// its own API version and the instance API version. A loader without the
+// vkEnumerateInstanceVersion function only supports the version 1.0.
+//
+// The optional features of the newer API versions are queried and enabled with
+// a chain of feature structures, where VkPhysicalDeviceFeatures2 is followed by
+// the VkPhysicalDeviceVulkan11/12/13Features structures supported by the API
+// version of the device. A device without vkGetPhysicalDeviceFeatures2 (i.e.
+// Vulkan 1.0) only reports the core VkPhysicalDeviceFeatures.
+//
+// The application enables a configurable set of the optional features, each of
+// which is a group of the feature bits needed by a modern rendering path. The
+// groups that the device does not support are skipped.
+// ============================================================================
+
+// The highest API version that the application knows how to use.
+#define MAX_API_VERSION VK_API_VERSION_1_3
+
+// The optional groups of device features used by the application.
+enum DeviceFeature
+{
+  DEVICE_FEATURE_TIMELINE_SEMAPHORE,
+  DEVICE_FEATURE_DESCRIPTOR_INDEXING,
+  DEVICE_FEATURE_BUFFER_DEVICE_ADDRESS,
+  DEVICE_FEATURE_SYNCHRONIZATION2,
+  DEVICE_FEATURE_DYNAMIC_RENDERING,
+  DEVICE_FEATURE_COUNT
+};
+
+#define DEVICE_FEATURE_BIT(feature) (1u << (feature))
+
+// The feature structures of a physical device. The pNext pointers are stored
+// as NULL (e.g. into the capability snapshot) and linked before each use.
+struct DeviceFeatureChain
+{
+  VkPhysicalDeviceFeatures2        core;
+  VkPhysicalDeviceVulkan11Features vulkan11;
+  VkPhysicalDeviceVulkan12Features vulkan12;
+  VkPhysicalDeviceVulkan13Features vulkan13;
+};
+
+// A description of an optional group of device features.
+struct DeviceFeatureInfo
+{
+  const char* name;
+  uint32_t    apiVersion;
+  bool      (*supported)(const DeviceFeatureChain& features);
+  void      (*enable)(DeviceFeatureChain& features);
+};
+
+static const DeviceFeatureInfo DEVICE_FEATURES[DEVICE_FEATURE_COUNT] = {
+  {
+    "timeline-semaphore", VK_API_VERSION_1_2,
+    [](const DeviceFeatureChain& f) { return f.vulkan12.timelineSemaphore == VK_TRUE; },
+    [](DeviceFeatureChain& f) { f.vulkan12.timelineSemaphore = VK_TRUE; }
+  },
+  {
+    "descriptor-indexing", VK_API_VERSION_1_2,
+    [](const DeviceFeatureChain& f) {
+      return f.vulkan12.descriptorIndexing == VK_TRUE
+        && f.vulkan12.runtimeDescriptorArray == VK_TRUE
+        && f.vulkan12.descriptorBindingPartiallyBound == VK_TRUE
+        && f.vulkan12.descriptorBindingVariableDescriptorCount == VK_TRUE
+        && f.vulkan12.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE
+        && f.vulkan12.shaderSampledImageArrayNonUniformIndexing == VK_TRUE;
+    },
+    [](DeviceFeatureChain& f) {
+      f.vulkan12.descriptorIndexing = VK_TRUE;
+      f.vulkan12.runtimeDescriptorArray = VK_TRUE;
+      f.vulkan12.descriptorBindingPartiallyBound = VK_TRUE;
+      f.vulkan12.descriptorBindingVariableDescriptorCount = VK_TRUE;
+      f.vulkan12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+      f.vulkan12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    }
+  },
+  {
+    "buffer-device-address", VK_API_VERSION_1_2,
+    [](const DeviceFeatureChain& f) { return f.vulkan12.bufferDeviceAddress == VK_TRUE; },
+    [](DeviceFeatureChain& f) { f.vulkan12.bufferDeviceAddress = VK_TRUE; }
+  },
+  {
+    "synchronization2", VK_API_VERSION_1_3,
+    [](const DeviceFeatureChain& f) { return f.vulkan13.synchronization2 == VK_TRUE; },
+    [](DeviceFeatureChain& f) { f.vulkan13.synchronization2 = VK_TRUE; }
+  },
+  {
+    "dynamic-rendering", VK_API_VERSION_1_3,
+    [](const DeviceFeatureChain& f) { return f.vulkan13.dynamicRendering == VK_TRUE; },
+    [](DeviceFeatureChain& f) { f.vulkan13.dynamicRendering = VK_TRUE; }
+  }
+};
+
+// The API version used to create the instance.
+static uint32_t sInstanceApiVersion = VK_API_VERSION_1_0;
+// The API version used with the selected physical device.
+static uint32_t sDeviceApiVersion = VK_API_VERSION_1_0;
+// The optional device features requested by the user (all by default).
+static uint32_t sRequestedDeviceFeatures = DEVICE_FEATURE_BIT(DEVICE_FEATURE_COUNT) - 1;
+// The optional device features enabled for the logical device.
+static uint32_t sDeviceFeatures = 0;
+
+// ============================================================================
+// Drop the patch version so that the versions can be compared and clamped.
+// @param version The full API version.
+// @returns The major and minor API version.
+static uint32_t api_version_minor(uint32_t version)
+{
+  return VK_MAKE_API_VERSION(0, VK_API_VERSION_MAJOR(version), VK_API_VERSION_MINOR(version), 0);
+}
+
+// ============================================================================
+// Get the API version that can be used with the physical device.
+// @param properties The properties of the physical device.
+// @returns The lower one of the device and the instance API version.
+static uint32_t device_api_version(const VkPhysicalDeviceProperties& properties)
+{
+  return std::min(api_version_minor(properties.apiVersion), sInstanceApiVersion);
+}
+
+// ============================================================================
+// Link the feature structures supported by the API version into a chain.
+// @param features The feature structures to be linked.
+// @param apiVersion The API version of the device.
+static void link_device_features(DeviceFeatureChain& features, uint32_t apiVersion)
+{
+  features.core.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.core.pNext = apiVersion >= VK_API_VERSION_1_2 ? &features.vulkan11 : NULL;
+  features.vulkan11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+  features.vulkan11.pNext = &features.vulkan12;
+  features.vulkan12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  features.vulkan12.pNext = apiVersion >= VK_API_VERSION_1_3 ? &features.vulkan13 : NULL;
+  features.vulkan13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+  features.vulkan13.pNext = NULL;
+}
+
+// ============================================================================
+// Clear the pointers of the feature chain before it is copied or stored.
+// @param features The feature structures to be unlinked.
+static void unlink_device_features(DeviceFeatureChain& features)
+{
+  features.core.pNext = NULL;
+  features.vulkan11.pNext = NULL;
+  features.vulkan12.pNext = NULL;
+  features.vulkan13.pNext = NULL;
+}
+
+// ============================================================================
+// Check whether the feature chain can be used with the API version.
+// @param apiVersion The API version of the device.
+static bool has_device_features2(uint32_t apiVersion)
+{
+  return apiVersion >= VK_API_VERSION_1_1 && vkGetPhysicalDeviceFeatures2 != NULL;
+}
+
+// ============================================================================
+// Query the features of the physical device.
+// @param device The target physical device.
+// @param apiVersion The API version of the device.
+// @param features The feature structures to be filled.
+static void query_device_features(const VkPhysicalDevice& device, uint32_t apiVersion, DeviceFeatureChain& features)
+{
+  features = {};
+  if (has_device_features2(apiVersion)) {
+    link_device_features(features, apiVersion);
+    vkGetPhysicalDeviceFeatures2(device, &features.core);
+  } else {
+    vkGetPhysicalDeviceFeatures(device, &features.core.features);
+  }
+  unlink_device_features(features);
+}
+
+// ============================================================================
+// Check whether the device supports the optional group of device features.
+// @param features The supported features of the device.
+// @param apiVersion The API version of the device.
+// @param feature The optional group of device features.
+static bool device_feature_supported(const DeviceFeatureChain& features, uint32_t apiVersion, DeviceFeature feature)
+{
+  const auto& info = DEVICE_FEATURES[feature];
+  return has_device_features2(apiVersion) && apiVersion >= info.apiVersion && info.supported(features);
+}
+
+// ============================================================================
+// Check whether the optional group of device features is enabled.
+// @param feature The optional group of device features.
+static bool has_device_feature(DeviceFeature feature)
+{
+  return (sDeviceFeatures & DEVICE_FEATURE_BIT(feature)) != 0;
+}
+
+// ============================================================================
+// CAPABILITY SNAPSHOT
+// ============================================================================
+// The layers, extensions, features and queue families do not change between
+// runs unless the loader or a driver is updated, but enumerating them makes the
+// loader scan its manifests and the drivers wake up their devices. Therefore
+// the results are stored into a capability snapshot file, which is memory
+// mapped and reused by the next runs as long as its keys still match.
+//
+//   loader version   vkEnumerateInstanceVersion, keys the whole snapshot.
+//   layer settings   VK_LAYER_PATH, VK_ADD_LAYER_PATH and VK_INSTANCE_LAYERS
+//                    and the modification times of the layer manifest
+//                    directories (or registry keys), keys the instance layers
+//                    and extensions.
+//   driver version   vendorID, deviceID, driverVersion and pipelineCacheUUID
+//                    of the device properties, keys each device record.
+//
+//   header | instance layers | instance extensions | device records
+//   device record = device | queue families | device extensions
+//
+// The names are stored with their hashes and sorted by the hash, so that the
+// required layers and extensions are found with a binary search. The snapshot
+// is rewritten off the critical path after something had to be enumerated.
+// ============================================================================
+
+// The magic number to identify our capability snapshot files ("VKCS").
+static const uint32_t CAPABILITY_SNAPSHOT_MAGIC = 0x53434B56;
+// The version of our capability snapshot file format.
+static const uint32_t CAPABILITY_SNAPSHOT_VERSION = 3;
+
+// A layer or extension name and its hash.
+struct CapabilityName
+{
+  uint64_t hash;
+  char     name[VK_MAX_EXTENSION_NAME_SIZE];
+};
+
+// A header at the beginning of the capability snapshot file.
+struct CapabilitySnapshotHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t loaderVersion;
+  uint32_t layerCount;
+  uint32_t extensionCount;
+  uint32_t deviceCount;
+  uint64_t layerSettingsHash;
+  uint64_t dataSize;
+  uint64_t dataHash;
+};
+
+// A device in the capability snapshot file, which is followed by its queue
+// families and extensions.
+struct CapabilitySnapshotDevice
+{
+  uint32_t           vendorID;
+  uint32_t           deviceID;
+  uint32_t           driverVersion;
+  uint8_t            pipelineCacheUUID[VK_UUID_SIZE];
+  uint32_t           queueFamilyCount;
+  uint32_t           extensionCount;
+  DeviceFeatureChain features;
+};
+
+// The capabilities of a physical device, either enumerated or from a snapshot.
+struct DeviceCapabilities
+{
+  CapabilitySnapshotDevice             device;
+  std::vector<VkQueueFamilyProperties> queueFamilies;
+  std::vector<CapabilityName>          extensions;
+};
+
+// Whether to use the capability snapshot from the previous run.
+static bool sUseCapabilitySnapshot = true;
+// The memory mapping of a valid capability snapshot file (if any).
+static MappedFile sCapabilitySnapshot = {};
+// Whether the instance layers and extensions were found from the snapshot.
+static bool sSnapshotInstanceCapabilities = false;
+// The hash of the environment and the manifests that affect the layers.
+static uint64_t sLayerSettingsHash = 0;
+// Whether something was enumerated and the snapshot must be rewritten.
+static std::atomic<bool> sCapabilitySnapshotStale(false);
+// The instance version supported by the loader.
+static uint32_t sLoaderVersion = VK_API_VERSION_1_0;
+// The available instance layers sorted by the hash of the name.
+static std::vector<CapabilityName> sInstanceLayers;
+// The available instance extensions sorted by the hash of the name.
+static std::vector<CapabilityName> sInstanceExtensions;
+// The capabilities of each of the physical devices.
+static std::vector<DeviceCapabilities> sDeviceCapabilities;
+// The capabilities of the selected physical device.
+static DeviceCapabilities sPhysicalDeviceCapabilities = {};
+
+// ============================================================================
+// Create a name entry with a hash of the specified name.
+// @param name The layer or extension name.
+// @returns The name entry.
+static CapabilityName capability_name(const char* name)
+{
+  CapabilityName entry = {};
+  strncpy(entry.name, name, VK_MAX_EXTENSION_NAME_SIZE - 1);
+  entry.hash = hash_bytes(reinterpret_cast<const uint8_t*>(entry.name), strlen(entry.name));
+  return entry;
+}
+
+// ============================================================================
+// Sort the names by their hashes so that they can be binary searched.
+// @param names The names to be sorted.
+static void sort_capability_names(std::vector<CapabilityName>& names)
+{
+  std::sort(names.begin(), names.end(), [](const CapabilityName& a, const CapabilityName& b) {
+    return a.hash < b.hash;
+  });
+}
+
+// ============================================================================
+// Check whether the sorted names contain the specified name.
+// @param names The names sorted by their hashes.
+// @param name The layer or extension name to find.
+// @returns true if the name was found.
+static bool has_capability(const std::vector<CapabilityName>& names, const char* name)
+{
+  auto hash = hash_bytes(reinterpret_cast<const uint8_t*>(name), strlen(name));
+  auto it = std::lower_bound(names.begin(), names.end(), hash, [](const CapabilityName& entry, uint64_t value) {
+    return entry.hash < value;
+  });
+  for (; it != names.end() && it->hash == hash; it++) {
+    if (strcmp(it->name, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// ============================================================================
+// Check whether the snapshot device record matches the device properties.
+// @param device The device record.
+// @param properties The properties of a physical device.
+// @returns true if the record was made for the same device and driver.
+static bool matches_snapshot_device(const CapabilitySnapshotDevice& device, const VkPhysicalDeviceProperties& properties)
+{
+  return device.vendorID == properties.vendorID
+    && device.deviceID == properties.deviceID
+    && device.driverVersion == properties.driverVersion
+    && memcmp(device.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+// ============================================================================
+// Append the modification time of a layer manifest directory into the layer
+// settings, as adding or removing a manifest changes the time.
+// @param settings The layer settings to be appended into.
+// @param path The path of the directory.
+static void append_layer_directory(std::string& settings, const std::string& path)
+{
+  settings += path;
+#ifdef _WIN32
+  WIN32_FILE_ATTRIBUTE_DATA attributes;
+  if (GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attributes)) {
+    settings += ":" + std::to_string(attributes.ftLastWriteTime.dwHighDateTime);
+    settings += ":" + std::to_string(attributes.ftLastWriteTime.dwLowDateTime);
+  }
+#else
+  struct stat status;
+  if (stat(path.c_str(), &status) == 0) {
+    settings += ":" + std::to_string(static_cast<long long>(status.st_mtime));
+  }
+#endif
+  settings += "\n";
+}
+
+// ============================================================================
+// Append each of the directories of a path list into the layer settings.
+// @param settings The layer settings to be appended into.
+// @param paths The list of paths separated by the platform path separator.
+// @param suffix The suffix appended into each of the paths.
+static void append_layer_directories(std::string& settings, const std::string& paths, const char* suffix)
+{
+#ifdef _WIN32
+  const char separator = ';';
+#else
+  const char separator = ':';
+#endif
+  size_t begin = 0;
+  while (begin <= paths.size()) {
+    auto end = paths.find(separator, begin);
+    if (end == std::string::npos) {
+      end = paths.size();
+    }
+    if (end > begin) {
+      append_layer_directory(settings, paths.substr(begin, end - begin) + suffix);
+    }
+    begin = end + 1;
+  }
+}
+
+// ============================================================================
+// Calculate a hash of the settings that affect which layers the loader finds,
+// i.e. the layer environment variables and the layer manifest locations.
+// @returns The hash of the layer settings.
+static uint64_t layer_settings_hash()
+{
+  std::string settings;
+  const char* variables[] = { "VK_LAYER_PATH", "VK_ADD_LAYER_PATH", "VK_INSTANCE_LAYERS" };
+  for (auto variable : variables) {
+    const char* value = getenv(variable);
+    settings += variable;
+    settings += "=";
+    settings += value != NULL ? value : "";
+    settings += "\n";
+    if (value != NULL && strcmp(variable, "VK_INSTANCE_LAYERS") != 0) {
+      append_layer_directories(settings, value, "");
+    }
+  }
+
+#ifdef _WIN32
+  // the layers are registered into the registry, which records a write time.
+  const HKEY roots[] = { HKEY_LOCAL_MACHINE, HKEY_CURRENT_USER };
+  const char* keys[] = { "SOFTWARE\\Khronos\\Vulkan\\ExplicitLayers", "SOFTWARE\\Khronos\\Vulkan\\ImplicitLayers" };
+  for (auto root : roots) {
+    for (auto key : keys) {
+      HKEY handle = NULL;
+      FILETIME writeTime = {};
+      if (RegOpenKeyEx(root, key, 0, KEY_READ, &handle) == ERROR_SUCCESS) {
+        RegQueryInfoKey(handle, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &writeTime);
+        RegCloseKey(handle);
+      }
+      settings += std::string(key) + ":" + std::to_string(writeTime.dwHighDateTime) + ":" + std::to_string(writeTime.dwLowDateTime) + "\n";
+    }
+  }
+#else
+  // the manifests are searched from the XDG configuration and data directories.
+  const char* home = getenv("HOME");
+  const std::string homePath = home != NULL ? home : "";
+  auto variable = [](const char* name, const std::string& fallback) {
+    const char* value = getenv(name);
+    return (value != NULL && value[0] != '\0') ? std::string(value) : fallback;
+  };
+  std::string paths = variable("XDG_CONFIG_HOME", homePath + "/.config");
+  paths += ":" + variable("XDG_CONFIG_DIRS", "/etc/xdg");
+  paths += ":/etc";
+  paths += ":" + variable("XDG_DATA_HOME", homePath + "/.local/share");
+  paths += ":" + variable("XDG_DATA_DIRS", "/usr/local/share:/usr/share");
+  append_layer_directories(settings, paths, "/vulkan/explicit_layer.d");
+  append_layer_directories(settings, paths, "/vulkan/implicit_layer.d");
+#endif
+  return hash_bytes(reinterpret_cast<const uint8_t*>(settings.data()), settings.size());
+}
+
+// ============================================================================
+// Memory map the capability snapshot file and check whether it can be used.
+// This is also where the loader version is queried, as it keys the snapshot.
+static void load_capability_snapshot()
+{
+  // the function is only available in loaders that support Vulkan 1.1.
+  if (vkEnumerateInstanceVersion) {
+    vkEnumerateInstanceVersion(&sLoaderVersion);
+  }
+  sSnapshotInstanceCapabilities = false;
+  if (!sUseCapabilitySnapshot) {
+    return;
+  }
+  sLayerSettingsHash = layer_settings_hash();
+
+  MappedFile file;
+  if (!map_file(CAPABILITY_SNAPSHOT_FILE, file)) {
+    LOG_INFO("No capability snapshot found, the capabilities are enumerated.\n");
+    return;
+  }
+
+  // validate the header and the checksum of the snapshot.
+  CapabilitySnapshotHeader header = {};
+  if (file.size >= sizeof(header)) {
+    memcpy(&header, file.data, sizeof(header));
+  }
+  const char* problem = nullptr;
+  if (file.size < sizeof(header)) {
+    problem = "is truncated";
+  } else if (header.magic != CAPABILITY_SNAPSHOT_MAGIC || header.version != CAPABILITY_SNAPSHOT_VERSION) {
+    problem = "has an unknown format";
+  } else if (header.loaderVersion != sLoaderVersion) {
+    problem = "was created with another loader";
+  } else if (header.dataSize != file.size - sizeof(header)) {
+    problem = "has an invalid data size";
+  } else if (header.dataHash != hash_bytes(file.data + sizeof(header), header.dataSize)) {
+    problem = "has an invalid checksum";
+  } else if (header.dataSize < (uint64_t(header.layerCount) + header.extensionCount) * sizeof(CapabilityName)) {
+    problem = "has invalid instance capabilities";
+  }
+  if (problem != nullptr) {
+    LOG_WARNING("The capability snapshot %s, the capabilities are enumerated.\n", problem);
+    unmap_file(file);
+    return;
+  }
+
+  // the instance capabilities follow the header and are already sorted, but
+  // they are only valid as long as the layer settings are the same.
+  sCapabilitySnapshot = file;
+  if (header.layerSettingsHash != sLayerSettingsHash) {
+    LOG_INFO("The layer settings have changed, the instance layers and extensions are enumerated.\n");
+    return;
+  }
+  auto names = reinterpret_cast<const CapabilityName*>(file.data + sizeof(header));
+  sInstanceLayers.assign(names, names + header.layerCount);
+  sInstanceExtensions.assign(names + header.layerCount, names + header.layerCount + header.extensionCount);
+  sSnapshotInstanceCapabilities = true;
+}
+
+// ============================================================================
+// Find the capabilities of a physical device from the capability snapshot.
+// @param properties The properties of the physical device.
+// @param capabilities The capabilities to be filled.
+// @returns true if the snapshot contains the device with the same driver.
+static bool find_snapshot_device_capabilities(const VkPhysicalDeviceProperties& properties, DeviceCapabilities& capabilities)
+{
+  if (sCapabilitySnapshot.data == nullptr) {
+    return false;
+  }
+
+  CapabilitySnapshotHeader header;
+  memcpy(&header, sCapabilitySnapshot.data, sizeof(header));
+  size_t offset = sizeof(header) + (size_t(header.layerCount) + header.extensionCount) * sizeof(CapabilityName);
+  for (auto i = 0u; i < header.deviceCount; i++) {
+    CapabilitySnapshotDevice device;
+    if (offset + sizeof(device) > sCapabilitySnapshot.size) {
+      return false;
+    }
+    memcpy(&device, sCapabilitySnapshot.data + offset, sizeof(device));
+    offset += sizeof(device);
+    auto queueFamiliesSize = size_t(device.queueFamilyCount) * sizeof(VkQueueFamilyProperties);
+    auto extensionsSize = size_t(device.extensionCount) * sizeof(CapabilityName);
+    if (offset + queueFamiliesSize + extensionsSize > sCapabilitySnapshot.size) {
+      return false;
+    }
+    if (matches_snapshot_device(device, properties)) {
+      auto queueFamilies = reinterpret_cast<const VkQueueFamilyProperties*>(sCapabilitySnapshot.data + offset);
+      auto extensions = reinterpret_cast<const CapabilityName*>(sCapabilitySnapshot.data + offset + queueFamiliesSize);
+      capabilities.device = device;
+      capabilities.queueFamilies.assign(queueFamilies, queueFamilies + device.queueFamilyCount);
+      capabilities.extensions.assign(extensions, extensions + device.extensionCount);
+      return true;
+    }
+    offset += queueFamiliesSize + extensionsSize;
+  }
+  return false;
+}
+
+// ============================================================================
+// Append the raw bytes of the values into the data.
+// @param data The data to be appended into.
+// @param values The values to be appended.
+// @param count The amount of values.
+template <typename T>
+static void append_snapshot_data(std::vector<uint8_t>& data, const T* values, size_t count)
+{
+  auto bytes = reinterpret_cast<const uint8_t*>(values);
+  data.insert(data.end(), bytes, bytes + count * sizeof(T));
+}
+
+// ============================================================================
+// Write a new capability snapshot if something had to be enumerated and then
+// release the mapping of the previous snapshot.
+static void save_capability_snapshot()
+{
+  if (sUseCapabilitySnapshot && sCapabilitySnapshotStale) {
+    CapabilitySnapshotHeader header = {};
+    header.magic = CAPABILITY_SNAPSHOT_MAGIC;
+    header.version = CAPABILITY_SNAPSHOT_VERSION;
+    header.loaderVersion = sLoaderVersion;
+    header.layerCount = static_cast<uint32_t>(sInstanceLayers.size());
+    header.extensionCount = static_cast<uint32_t>(sInstanceExtensions.size());
+    header.deviceCount = static_cast<uint32_t>(sDeviceCapabilities.size());
+    header.layerSettingsHash = sLayerSettingsHash;
+
+    std::vector<uint8_t> data;
+    append_snapshot_data(data, &header, 1);
+    append_snapshot_data(data, sInstanceLayers.data(), sInstanceLayers.size());
+    append_snapshot_data(data, sInstanceExtensions.data(), sInstanceExtensions.size());
+    for (const auto& capabilities : sDeviceCapabilities) {
+      append_snapshot_data(data, &capabilities.device, 1);
+      append_snapshot_data(data, capabilities.queueFamilies.data(), capabilities.queueFamilies.size());
+      append_snapshot_data(data, capabilities.extensions.data(), capabilities.extensions.size());
+    }
+    header.dataSize = data.size() - sizeof(header);
+    header.dataHash = hash_bytes(data.data() + sizeof(header), header.dataSize);
+    memcpy(data.data(), &header, sizeof(header));
+
+    // the previous snapshot must be released before the file can be replaced.
+    unmap_file(sCapabilitySnapshot);
+    if (write_file_atomically(CAPABILITY_SNAPSHOT_FILE, data.data(), data.size())) {
+      LOG_INFO("Saved a capability snapshot with [%d] device(s).\n", header.deviceCount);
+    }
+    sCapabilitySnapshotStale = false;
+  }
+  unmap_file(sCapabilitySnapshot);
+}
+
+// ============================================================================
+// DEBUG MESSENGER
+// ============================================================================
+// The debug messenger receives the messages of the validation layers through a
+// callback. The callback may be called by any thread that calls into Vulkan,
+// including the internal threads of the driver, so it must neither block nor
+// call back into the log, which would serialize the callers behind a lock.
+//
+// Instead the callback pushes the messages into a bounded lock-free queue with
+// multiple producers and a single consumer. Each slot of the queue has its own
+// sequence number, which tells whether the slot is free for the producer of a
+// given position or filled for the consumer of a given position. The messages
+// that do not fit into the queue are dropped and counted.
+//
+// The validation layers tend to repeat the same message for every frame, so
+// only the first occurrence of each message is queued and the repeats are just
+// counted. The messages are identified by their message ID number or, when it
+// is zero, by the hash of the message ID name. Finally, the amount of messages
+// queued within a second is limited, so that a burst of messages can't flood
+// the log. A message is only registered as seen once it has been queued, so a
+// message that was rate limited or dropped is still logged when it repeats.
+// The queue is drained into the log once per frame.
+//
+// The VERBOSE and INFO severities are only subscribed to when the debug level
+// messages are compiled in, as they would otherwise be filtered out by the log
+// after paying for the formatting and the queueing.
+//
+// The PERFORMANCE type messages (e.g. from the best practices checks) are also
+// collected into a performance report, which lists each distinct message with
+// its amount of occurrences when the instance is destroyed. They are recorded
+// by the callback into a bounded lock-free table of their own, before the rate
+// limit and the queue, so that the report sees every occurrence of them.
+// ============================================================================
+
+// The amount of slots in the message queue (must be a power of two).
+#define DEBUG_MESSAGE_QUEUE_CAPACITY 256
+// The maximum length of a single message, including the terminating null.
+#define DEBUG_MESSAGE_SIZE 512
+// The amount of slots in the message ID table (must be a power of two).
+#define DEBUG_MESSAGE_ID_TABLE_SIZE 1024
+// The maximum amount of messages queued within a second.
+#define DEBUG_MESSAGE_RATE_LIMIT 64
+// The amount of slots in the performance message table (must be a power of two).
+#define PERFORMANCE_MESSAGE_TABLE_SIZE 256
+
+// A message received by the debug messenger callback.
+struct DebugMessage
+{
+  std::atomic<uint64_t>                  sequence;
+  uint64_t                               key;
+  VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+  VkDebugUtilsMessageTypeFlagsEXT        type;
+  char                                   text[DEBUG_MESSAGE_SIZE];
+};
+
+// An occurrence counter of the messages with the same identifier.
+struct DebugMessageId
+{
+  std::atomic<uint64_t> key;
+  std::atomic<uint32_t> count;
+};
+
+// A distinct performance message collected for the performance report. The
+// text is written by the thread that claims the slot before it's published.
+struct PerformanceMessage
+{
+  std::atomic<uint64_t> key;
+  std::atomic<uint32_t> count;
+  std::atomic<bool>     published;
+  char                  text[DEBUG_MESSAGE_SIZE];
+};
+
+static VkDebugUtilsMessengerEXT sDebugMessenger = VK_NULL_HANDLE;
+static DebugMessage sDebugMessages[DEBUG_MESSAGE_QUEUE_CAPACITY];
+static std::atomic<uint64_t> sDebugMessageEnqueuePosition(0);
+static uint64_t sDebugMessageDequeuePosition = 0;
+static std::mutex sDebugMessageDequeueMutex;
+static DebugMessageId sDebugMessageIds[DEBUG_MESSAGE_ID_TABLE_SIZE];
+static std::atomic<int64_t> sDebugMessageRateWindow(0);
+static std::atomic<uint32_t> sDebugMessageRateCount(0);
+static std::atomic<uint64_t> sDebugMessagesQueued(0);
+static std::atomic<uint64_t> sDebugMessagesRepeated(0);
+static std::atomic<uint64_t> sDebugMessagesRateLimited(0);
+static std::atomic<uint64_t> sDebugMessagesDropped(0);
+static PerformanceMessage sPerformanceMessages[PERFORMANCE_MESSAGE_TABLE_SIZE];
+static std::atomic<uint64_t> sPerformanceMessagesDropped(0);
+
+// ============================================================================
+// Reset the message queue and the message ID table into their initial state.
+// This must not be called while a debug messenger exists.
+static void reset_debug_messages()
+{
+  for (uint64_t i = 0; i < DEBUG_MESSAGE_QUEUE_CAPACITY; i++) {
+    sDebugMessages[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  sDebugMessageEnqueuePosition = 0;
+  sDebugMessageDequeuePosition = 0;
+  for (auto& id : sDebugMessageIds) {
+    id.key.store(0, std::memory_order_relaxed);
+    id.count.store(0, std::memory_order_relaxed);
+  }
+  sDebugMessageRateWindow = 0;
+  sDebugMessageRateCount = 0;
+  sDebugMessagesQueued = 0;
+  sDebugMessagesRepeated = 0;
+  sDebugMessagesRateLimited = 0;
+  sDebugMessagesDropped = 0;
+  for (auto& message : sPerformanceMessages) {
+    message.key.store(0, std::memory_order_relaxed);
+    message.count.store(0, std::memory_order_relaxed);
+    message.published.store(false, std::memory_order_relaxed);
+  }
+  sPerformanceMessagesDropped = 0;
+}
+
+// ============================================================================
+// Get the identifier of a message.
+// @param data The callback data of the message.
+// @returns The identifier of the message or zero if it has none.
+static uint64_t debug_message_key(const VkDebugUtilsMessengerCallbackDataEXT* data)
+{
+  // the zero key marks an empty slot, so the IDs are tagged with a high bit.
+  if (data->messageIdNumber != 0) {
+    return static_cast<uint32_t>(data->messageIdNumber) | (1ull << 32);
+  } else if (data->pMessageIdName != NULL) {
+    return hash_bytes(reinterpret_cast<const uint8_t*>(data->pMessageIdName), strlen(data->pMessageIdName)) | (1ull << 63);
+  } else if (data->pMessage != NULL) {
+    return hash_bytes(reinterpret_cast<const uint8_t*>(data->pMessage), strlen(data->pMessage)) | (1ull << 63);
+  }
+  return 0;
+}
+
+// ============================================================================
+// Find the occurrence counter of a message from the message ID table. The table
+// is never emptied while the messenger exists, so a key that is once stored
+// into a slot stays there. When the table is full, every message looks like a
+// new one.
+// @param key The identifier of the message.
+// @param insert Whether to register the message if it's not in the table.
+// @returns The occurrence counter or nullptr if not found (or no space left).
+static DebugMessageId* find_debug_message_id(uint64_t key, bool insert)
+{
+  const uint64_t mask = DEBUG_MESSAGE_ID_TABLE_SIZE - 1;
+  for (uint64_t i = 0; key != 0 && i < DEBUG_MESSAGE_ID_TABLE_SIZE; i++) {
+    auto& id = sDebugMessageIds[(key + i) & mask];
+    auto current = id.key.load(std::memory_order_acquire);
+    if (current == 0) {
+      if (!insert) {
+        break;
+      }
+      if (id.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+        current = key;
+      }
+    }
+    if (current == key) {
+      return &id;
+    }
+  }
+  return nullptr;
+}
+
+// ============================================================================
+// Count an occurrence of a performance message in the performance message
+// table. The first occurrence claims a slot and copies the text into it. When
+// the table is full, the occurrences of new messages are only counted.
+// @param key The identifier of the message.
+// @param data The callback data of the message.
+static void record_performance_message(uint64_t key, const VkDebugUtilsMessengerCallbackDataEXT* data)
+{
+  const uint64_t mask = PERFORMANCE_MESSAGE_TABLE_SIZE - 1;
+  for (uint64_t i = 0; key != 0 && i < PERFORMANCE_MESSAGE_TABLE_SIZE; i++) {
+    auto& message = sPerformanceMessages[(key + i) & mask];
+    auto current = message.key.load(std::memory_order_acquire);
+    if (current == 0 && message.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+      snprintf(message.text, sizeof(message.text), "%s%s%s",
+               data->pMessageIdName != NULL ? data->pMessageIdName : "",
+               data->pMessageIdName != NULL ? ": " : "",
+               data->pMessage != NULL ? data->pMessage : "");
+      message.published.store(true, std::memory_order_release);
+      current = key;
+    }
+    if (current == key) {
+      message.count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  sPerformanceMessagesDropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+// ============================================================================
+// Check whether a message may still be queued within the current second. The
+// window is reset without a lock, so a few extra messages may slip through in
+// the instant that the window changes.
+static bool debug_message_rate_allowed()
+{
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  auto second = static_cast<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(now).count());
+  auto window = sDebugMessageRateWindow.load(std::memory_order_relaxed);
+  if (window != second && sDebugMessageRateWindow.compare_exchange_strong(window, second, std::memory_order_relaxed)) {
+    sDebugMessageRateCount.store(0, std::memory_order_relaxed);
+  }
+  return sDebugMessageRateCount.fetch_add(1, std::memory_order_relaxed) < DEBUG_MESSAGE_RATE_LIMIT;
+}
+
+// ============================================================================
+// Push a message into the message queue. Returns false if the queue is full.
+// @param key The identifier of the message.
+// @param severity The severity of the message.
+// @param type The type of the message.
+// @param data The callback data of the message.
+static bool enqueue_debug_message(uint64_t key,
+                                  VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+                                  VkDebugUtilsMessageTypeFlagsEXT type,
+                                  const VkDebugUtilsMessengerCallbackDataEXT* data)
+{
+  // claim a position whose slot has been released by the consumer.
+  DebugMessage* slot = NULL;
+  auto position = sDebugMessageEnqueuePosition.load(std::memory_order_relaxed);
+  for (;;) {
+    slot = &sDebugMessages[position & (DEBUG_MESSAGE_QUEUE_CAPACITY - 1)];
+    auto sequence = slot->sequence.load(std::memory_order_acquire);
+    auto difference = static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+    if (difference == 0) {
+      if (sDebugMessageEnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (difference < 0) {
+      return false;
+    } else {
+      position = sDebugMessageEnqueuePosition.load(std::memory_order_relaxed);
+    }
+  }
+
+  // fill the slot and publish it to the consumer.
+  slot->key = key;
+  slot->severity = severity;
+  slot->type = type;
+  snprintf(slot->text, sizeof(slot->text), "%s%s%s",
+           data->pMessageIdName != NULL ? data->pMessageIdName : "",
+           data->pMessageIdName != NULL ? ": " : "",
+           data->pMessage != NULL ? data->pMessage : "");
+  slot->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+// ============================================================================
+// The debug messenger callback, which may be called from any thread.
+static VKAPI_ATTR VkBool32 VKAPI_CALL debug_messenger_callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+                                                               VkDebugUtilsMessageTypeFlagsEXT type,
+                                                               const VkDebugUtilsMessengerCallbackDataEXT* data,
+                                                               void* userData)
+{
+  (void)userData;
+  auto key = debug_message_key(data);
+  if ((type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) != 0) {
+    record_performance_message(key, data);
+  }
+  auto id = find_debug_message_id(key, false);
+  if (id != nullptr) {
+    id->count.fetch_add(1, std::memory_order_relaxed);
+    sDebugMessagesRepeated.fetch_add(1, std::memory_order_relaxed);
+  } else if (!debug_message_rate_allowed()) {
+    sDebugMessagesRateLimited.fetch_add(1, std::memory_order_relaxed);
+  } else if (!enqueue_debug_message(key, severity, type, data)) {
+    sDebugMessagesDropped.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    // a concurrent first occurrence may also be queued, which is only logged twice.
+    sDebugMessagesQueued.fetch_add(1, std::memory_order_relaxed);
+    id = find_debug_message_id(key, true);
+    if (id != nullptr) {
+      id->count.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // the call that triggered the message should not be aborted.
+  return VK_FALSE;
+}
+
+// ============================================================================
+// Pop the queued messages and write them into the log.
+static void drain_debug_messages()
+{
+  std::lock_guard<std::mutex> lock(sDebugMessageDequeueMutex);
+  for (;;) {
+    auto position = sDebugMessageDequeuePosition;
+    auto& slot = sDebugMessages[position & (DEBUG_MESSAGE_QUEUE_CAPACITY - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+      break;
+    }
+
+    const char* type = "general";
+    if ((slot.type & VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT) != 0) {
+      type = "validation";
+    } else if ((slot.type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) != 0) {
+      type = "performance";
+    }
+    if (slot.severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+      LOG_ERROR("Vulkan %s error: %s\n", type, slot.text);
+    } else if (slot.severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+      LOG_WARNING("Vulkan %s warning: %s\n", type, slot.text);
+    } else {
+      LOG_DEBUG("Vulkan %s message: %s\n", type, slot.text);
+    }
+
+    // release the slot for the producer of the next round.
+    slot.sequence.store(position + DEBUG_MESSAGE_QUEUE_CAPACITY, std::memory_order_release);
+    sDebugMessageDequeuePosition = position + 1;
+  }
+}
+
+// ============================================================================
+// Fill the create info of a debug messenger, which is also chained into the
+// instance create info to receive the messages of the instance creation.
+// @param info The create info to be filled.
+static void fill_debug_messenger_info(VkDebugUtilsMessengerCreateInfoEXT& info)
+{
+  info = {};
+  info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+  info.pNext = NULL;
+  info.flags = 0;
+  info.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
+                       | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+  if (LOG_LEVEL <= LOG_LEVEL_DEBUG) {
+    info.messageSeverity |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT
+                          | VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT;
+  }
+  info.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
+                   | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT
+                   | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+  info.pfnUserCallback = debug_messenger_callback;
+  info.pUserData = NULL;
+}
+
+// ============================================================================
+
+static void create_debug_messenger()
+{
+  VkDebugUtilsMessengerCreateInfoEXT info;
+  fill_debug_messenger_info(info);
+  auto result = vkCreateDebugUtilsMessengerEXT(sInstance, &info, host_allocator(), &sDebugMessenger);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkCreateDebugUtilsMessengerEXT failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+}
+
+// ============================================================================
+
+static void destroy_debug_messenger()
+{
+  if (sDebugMessenger != VK_NULL_HANDLE) {
+    vkDestroyDebugUtilsMessengerEXT(sInstance, sDebugMessenger, host_allocator());
+    sDebugMessenger = VK_NULL_HANDLE;
+  }
+}
+
+// ============================================================================
+// Drain the remaining messages and print out how many messages were received.
+static void print_debug_message_statistics()
+{
+  drain_debug_messages();
+  uint64_t queued = sDebugMessagesQueued;
+  uint64_t repeated = sDebugMessagesRepeated;
+  uint64_t rateLimited = sDebugMessagesRateLimited;
+  uint64_t dropped = sDebugMessagesDropped;
+  if (queued + repeated + rateLimited + dropped > 0) {
+    LOG_INFO("Debug messages: [%llu] logged, [%llu] repeated, [%llu] rate limited, [%llu] dropped.\n",
+             static_cast<unsigned long long>(queued),
+             static_cast<unsigned long long>(repeated),
+             static_cast<unsigned long long>(rateLimited),
+             static_cast<unsigned long long>(dropped));
+  }
+}
+
+// ============================================================================
+// Print out the distinct performance messages ordered by their occurrences.
+static void print_performance_report()
+{
+  std::vector<std::pair<uint32_t, const PerformanceMessage*>> messages;
+  uint64_t total = 0;
+  for (const auto& message : sPerformanceMessages) {
+    if (message.published.load(std::memory_order_acquire)) {
+      auto count = message.count.load(std::memory_order_relaxed);
+      messages.push_back(std::make_pair(count, &message));
+      total += count;
+    }
+  }
+  uint64_t dropped = sPerformanceMessagesDropped;
+  if (messages.empty() && dropped == 0) {
+    if (sBestPracticesEnabled) {
+      LOG_INFO("Performance report: no performance warnings.\n");
+    }
+    return;
+  }
+  std::stable_sort(messages.begin(), messages.end(), [](const std::pair<uint32_t, const PerformanceMessage*>& a,
+                                                        const std::pair<uint32_t, const PerformanceMessage*>& b) {
+    return a.first > b.first;
+  });
+
+  LOG_INFO("Performance report: [%d] distinct performance warning(s) with [%llu] occurrence(s):\n",
+           static_cast<int>(messages.size()),
+           static_cast<unsigned long long>(total));
+  for (const auto& message : messages) {
+    LOG_INFO("\t%8u  %.200s\n", message.first, message.second->text);
+  }
+  if (dropped > 0) {
+    LOG_INFO("\t%8llu  (occurrences of messages that did not fit into the report)\n", static_cast<unsigned long long>(dropped));
+  }
+}
+
+// ============================================================================
+// PHYSICAL DEVICES
+// ============================================================================
+// Vulkan seperates devices into physical and logical devices.
+//
+// Physical device represents a single complete implementation of Vulkan that
+// is available for the host machine.
+//
+// Vulkan requires us to first enumerate and then select a suitable physical
+// device for our application. For this purpose, we should do following things.
+//
+//   1. Enumerate available physical devices.
+//   2. Check and rate devices based on their support to required properties.
+//   3. Check and rate devices based on their support to required features.
+//
+// The requirements (API version, features, limits, extensions and formats) are
+// described declaratively by device_requirements(). The same description is
+// used to reject the devices that don't fulfill it and to enable the required
+// features and extensions when the logical device is created.
+//
+// In addition to previously mentioned device support checks, we also need to
+// check which queue family we can use in our processing. This is done by first
+// enumerating all device queue families and then finding the index of a queue
+// which supports our required set of features (e.g. graphics handling etc.).
+//
+// Each suitable device is scored based on its type, the amount of device local
+// memory, some of its limits and the topology of its queue families. The best
+// scoring device is used unless the user requests a specific device with the
+// SANDBOX_DEVICE environment variable or with the --device=<index|name> arg.
+// ============================================================================
+
+static std::vector<VkPhysicalDevice> enumerate_physical_devices()
+{
+  // calculate how many devices the host machine contains.
+  uint32_t deviceCount = 0;
+  auto result = vkEnumeratePhysicalDevices(sInstance, &deviceCount, NULL);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkEnumeratePhysicalDevices failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+
+  // get handles for each available device.
+  std::vector<VkPhysicalDevice> devices(deviceCount);
+  result = vkEnumeratePhysicalDevices(sInstance, &deviceCount, devices.data());
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkEnumeratePhysicalDevices failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+
+  // return the results back to caller.
+  LOG_INFO("Vulkan API found [%d] physical device(s).\n", deviceCount);
+  return devices;
+}
+
+// ============================================================================
+
+static std::vector<VkQueueFamilyProperties> enumerate_queue_family_properties(const VkPhysicalDevice& device)
+{
+  // calculate how many queue families the physical device supports.
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
+
+  // get handles for each available queue family.
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+  // return the results back to caller.
+  LOG_INFO("Vulkan API found [%d] queue families for the target physical device.\n", queueFamilyCount);
+  return queueFamilies;
+}
+
+// ============================================================================
+
+static std::vector<VkExtensionProperties> enumerate_available_extensions(const VkPhysicalDevice& device)
+{
+  // calculate how many extensions the physical device supports.
+  uint32_t extensionCount = 0;
+  vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, NULL);
+
+  // get handles for each available extension.
+  std::vector<VkExtensionProperties> extensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, extensions.data());
+
+  // return the results back to caller.
+  LOG_INFO("Vulkan API found [%d] device extension(s).\n", extensionCount);
+  return extensions;
+}
+
+// ============================================================================
+
+// A description of a physical device which is a candidate for selection.
+struct PhysicalDeviceCandidate
+{
+  VkPhysicalDevice device;
+  VkPhysicalDeviceProperties properties;
+  DeviceCapabilities capabilities;
+  int graphicsQueueFamilyIndex;
+  int presentQueueFamilyIndex;
+  bool suitable;
+  uint64_t score;
+};
+
+// A core feature that the device must support.
+struct DeviceFeatureRequirement
+{
+  const char* name;
+  VkBool32 VkPhysicalDeviceFeatures::* feature;
+};
+
+#define DEVICE_CORE_FEATURE(name) { #name, &VkPhysicalDeviceFeatures::name }
+
+// A limit that the device must reach.
+struct DeviceLimitRequirement
+{
+  const char* name;
+  uint32_t VkPhysicalDeviceLimits::* limit;
+  uint32_t minimum;
+};
+
+#define DEVICE_LIMIT(name, minimum) { #name, &VkPhysicalDeviceLimits::name, static_cast<uint32_t>(minimum) }
+
+// A format that must support the features with the optimal tiling.
+struct DeviceFormatRequirement
+{
+  VkFormat            format;
+  VkFormatFeatureFlags features;
+};
+
+// The requirements that a physical device must fulfill to be selected.
+struct DeviceRequirements
+{
+  uint32_t                              apiVersion;
+  std::vector<DeviceFeatureRequirement> coreFeatures;
+  uint32_t                              features;
+  std::vector<DeviceLimitRequirement>   limits;
+  std::vector<const char*>              extensions;
+  std::vector<DeviceFormatRequirement>  formats;
+};
+
+// The requirements used to select the physical device.
+static DeviceRequirements sDeviceRequirements = {};
+// The optional device features that the user requires the device to support.
+static uint32_t sRequiredDeviceFeatures = 0;
+
+// ============================================================================
+// Describe the requirements that a physical device must fulfill in the current
+// execution mode. Everything that the application depends on must be listed
+// here, as only the listed features and extensions are enabled.
+// @returns The description of the device requirements.
+static DeviceRequirements device_requirements()
+{
+  DeviceRequirements requirements = {};
+  requirements.apiVersion = VK_API_VERSION_1_0;
+
+  // no core features are used yet, e.g. DEVICE_CORE_FEATURE(samplerAnisotropy).
+  requirements.coreFeatures = {};
+  requirements.features = sRequiredDeviceFeatures;
+  requirements.limits = {
+    DEVICE_LIMIT(maxImageDimension2D, std::max(OFFSCREEN_IMAGE_WIDTH, OFFSCREEN_IMAGE_HEIGHT)),
+    DEVICE_LIMIT(maxColorAttachments, 1)
+  };
+
+  // a swapchain is not needed when rendering only into offscreen images.
+  if (sHeadless) {
+    requirements.formats = {
+      { OFFSCREEN_IMAGE_FORMAT, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT }
+    };
+  } else {
+    requirements.extensions = DEVICE_EXTENSIONS;
+  }
+  return requirements;
+}
+
+// ============================================================================
+// Check whether the device fulfills the requirements and print out each of the
+// requirements that it doesn't fulfill.
+// @param device The target physical device.
+// @param properties The properties of the target physical device.
+// @param capabilities The capabilities of the target physical device.
+// @param requirements The requirements to be checked.
+// @returns true if all of the requirements are fulfilled.
+static bool check_device_requirements(const VkPhysicalDevice& device,
+                                      const VkPhysicalDeviceProperties& properties,
+                                      const DeviceCapabilities& capabilities,
+                                      const DeviceRequirements& requirements)
+{
+  auto fulfilled = true;
+  auto apiVersion = device_api_version(properties);
+  if (apiVersion < requirements.apiVersion) {
+    LOG_INFO("\tmissing api version: %d.%d\n",
+      VK_API_VERSION_MAJOR(requirements.apiVersion),
+      VK_API_VERSION_MINOR(requirements.apiVersion));
+    fulfilled = false;
+  }
+
+  const auto& features = capabilities.device.features;
+  for (const auto& requirement : requirements.coreFeatures) {
+    if (features.core.features.*requirement.feature != VK_TRUE) {
+      LOG_INFO("\tmissing feature: %s\n", requirement.name);
+      fulfilled = false;
+    }
+  }
+  for (int feature = 0; feature < DEVICE_FEATURE_COUNT; feature++) {
+    if ((requirements.features & DEVICE_FEATURE_BIT(feature)) != 0
+      && !device_feature_supported(features, apiVersion, static_cast<DeviceFeature>(feature))) {
+      LOG_INFO("\tmissing feature: %s\n", DEVICE_FEATURES[feature].name);
+      fulfilled = false;
+    }
+  }
+
+  for (const auto& requirement : requirements.limits) {
+    auto value = properties.limits.*requirement.limit;
+    if (value < requirement.minimum) {
+      LOG_INFO("\tinsufficient limit: %s (%u < %u)\n", requirement.name, value, requirement.minimum);
+      fulfilled = false;
+    }
+  }
+
+  for (const auto& extension : requirements.extensions) {
+    if (!has_capability(capabilities.extensions, extension)) {
+      LOG_INFO("\tmissing extension: %s\n", extension);
+      fulfilled = false;
+    }
+  }
+
+  for (const auto& requirement : requirements.formats) {
+    VkFormatProperties formatProperties = {};
+    vkGetPhysicalDeviceFormatProperties(device, requirement.format, &formatProperties);
+    if ((formatProperties.optimalTilingFeatures & requirement.features) != requirement.features) {
+      LOG_INFO("\tmissing format features: format %d (0x%x)\n",
+        static_cast<int>(requirement.format),
+        requirement.features & ~formatProperties.optimalTilingFeatures);
+      fulfilled = false;
+    }
+  }
+  return fulfilled;
+}
+
+// ============================================================================
+// Calculate the size of the largest device local memory heap of the device.
+// @param device The target physical device.
+// @returns The size of the heap in bytes.
+static VkDeviceSize largest_device_local_heap_size(const VkPhysicalDevice& device)
+{
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+
+  VkDeviceSize heapSize = 0;
+  for (auto i = 0u; i < memoryProperties.memoryHeapCount; i++) {
+    const auto& heap = memoryProperties.memoryHeaps[i];
+    if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0 && heap.size > heapSize) {
+      heapSize = heap.size;
+    }
+  }
+  return heapSize;
+}
+
+// ============================================================================
+// Calculate a score for the physical device, where a higher score is better.
+//
+// The device type dominates the score so that a discrete device is always
+// preferred over an integrated one and an integrated over a CPU device. Other
+// properties are only used to rank devices of the same type.
+//
+// @param device The target physical device.
+// @param properties The properties of the target physical device.
+// @param queueFamilies The queue families of the target physical device.
+// @param candidate The candidate whose queue family indices are already set.
+// @returns The score of the device.
+static uint64_t score_physical_device(const VkPhysicalDevice& device,
+                                      const VkPhysicalDeviceProperties& properties,
+                                      const std::vector<VkQueueFamilyProperties>& queueFamilies,
+                                      const PhysicalDeviceCandidate& candidate)
+{
+  // score the device type.
+  uint64_t typeScore = 0;
+  switch (properties.deviceType) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+      typeScore = 100000;
+      break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+      typeScore = 50000;
+      break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+      typeScore = 25000;
+      break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+      typeScore = 10000;
+      break;
+    default:
+      typeScore = 0;
+      break;
+  }
+
+  // score the amount of device local memory (a point per 64 MiB).
+  uint64_t memoryScore = largest_device_local_heap_size(device) / (64ull * 1024ull * 1024ull);
+  memoryScore = std::min<uint64_t>(memoryScore, 5000);
+
+  // score the device limits that are relevant for rendering throughput.
+  const auto& limits = properties.limits;
+  uint64_t limitScore = 0;
+  limitScore += limits.maxImageDimension2D / 1024;
+  limitScore += limits.maxComputeSharedMemorySize / 4096;
+  limitScore += limits.maxColorAttachments;
+  limitScore += limits.maxBoundDescriptorSets;
+  limitScore += limits.maxPerStageDescriptorSampledImages >= 1024 ? 16 : 0;
+  limitScore += limits.timestampComputeAndGraphics ? 16 : 0;
+
+  // score the queue family topology, where dedicated queues allow overlapping.
+  uint64_t queueScore = 0;
+  bool hasDedicatedCompute = false;
+  bool hasDedicatedTransfer = false;
+  for (const auto& queueFamily : queueFamilies) {
+    auto flags = queueFamily.queueFlags;
+    if ((flags & VK_QUEUE_COMPUTE_BIT) != 0 && (flags & VK_QUEUE_GRAPHICS_BIT) == 0) {
+      hasDedicatedCompute = true;
+    }
+    if ((flags & VK_QUEUE_TRANSFER_BIT) != 0 && (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0) {
+      hasDedicatedTransfer = true;
+    }
+  }
+  queueScore += hasDedicatedCompute ? 200 : 0;
+  queueScore += hasDedicatedTransfer ? 200 : 0;
+  queueScore += candidate.graphicsQueueFamilyIndex == candidate.presentQueueFamilyIndex ? 100 : 0;
+
+  LOG_INFO("\tscore: %llu (type: %llu, memory: %llu, limits: %llu, queues: %llu)\n",
+    static_cast<unsigned long long>(typeScore + memoryScore + limitScore + queueScore),
+    static_cast<unsigned long long>(typeScore),
+    static_cast<unsigned long long>(memoryScore),
+    static_cast<unsigned long long>(limitScore),
+    static_cast<unsigned long long>(queueScore));
+  return typeScore + memoryScore + limitScore + queueScore;
+}
+
+// ============================================================================
+// Enumerate the capabilities of the physical device and print them out.
+// @param device The target physical device.
+// @param properties The properties of the target physical device.
+// @param capabilities The capabilities to be filled.
+static void enumerate_device_capabilities(const VkPhysicalDevice& device,
+                                          const VkPhysicalDeviceProperties& properties,
+                                          DeviceCapabilities& capabilities)
+{
+  // get the key of the device, which identifies it in the snapshot.
+  auto& record = capabilities.device;
+  record.vendorID = properties.vendorID;
+  record.deviceID = properties.deviceID;
+  record.driverVersion = properties.driverVersion;
+  memcpy(record.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+  // get a support information from the device.
+  auto apiVersion = device_api_version(properties);
+  query_device_features(device, apiVersion, record.features);
+
+  // print out some support information.
+  LOG_INFO("\t%s\n", properties.deviceName);
+  LOG_DEBUG("\t\tapi version:\t%d.%d\n", VK_API_VERSION_MAJOR(properties.apiVersion), VK_API_VERSION_MINOR(properties.apiVersion));
+  LOG_DEBUG("\t\tsupports geometry shader:\t%d\n", record.features.core.features.geometryShader);
+  LOG_DEBUG("\t\tsupports tesselation shader:\t%d\n", record.features.core.features.tessellationShader);
+  for (int feature = 0; feature < DEVICE_FEATURE_COUNT; feature++) {
+    LOG_DEBUG("\t\tsupports %s:\t%d\n",
+      DEVICE_FEATURES[feature].name,
+      device_feature_supported(record.features, apiVersion, static_cast<DeviceFeature>(feature)) ? 1 : 0);
+  }
+
+  auto deviceExtensions = enumerate_available_extensions(device);
+  LOG_DEBUG("\tdevice-extensions:\n");
+  capabilities.extensions.clear();
+  for (const auto& deviceExtension : deviceExtensions) {
+    LOG_DEBUG("\t\t%s\n", deviceExtension.extensionName);
+    capabilities.extensions.push_back(capability_name(deviceExtension.extensionName));
+  }
+  sort_capability_names(capabilities.extensions);
+
+  capabilities.queueFamilies = enumerate_queue_family_properties(device);
+  for (auto i = 0u; i < capabilities.queueFamilies.size(); i++) {
+    // print out some queue family information.
+    LOG_DEBUG("\tqueue-family: %d\n", i);
+    LOG_DEBUG("\t\tsupports graphics:\t%d\n", (capabilities.queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0 ? 1 : 0);
+    LOG_DEBUG("\t\tsupports compute:\t%d\n", (capabilities.queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0 ? 1 : 0);
+  }
+  record.queueFamilyCount = static_cast<uint32_t>(capabilities.queueFamilies.size());
+  record.extensionCount = static_cast<uint32_t>(capabilities.extensions.size());
+}
+
+// ============================================================================
+// Check whether the physical device is suitable and resolve its queue families.
+// @param device The target physical device.
+// @returns A candidate description of the physical device.
+static PhysicalDeviceCandidate probe_physical_device(const VkPhysicalDevice& device)
+{
+  TraceZone zone("probe_physical_device");
+  PhysicalDeviceCandidate candidate = {};
+  candidate.device = device;
+  candidate.graphicsQueueFamilyIndex = -1;
+  candidate.presentQueueFamilyIndex = -1;
+  vkGetPhysicalDeviceProperties(device, &candidate.properties);
+
+  // use the capabilities from the snapshot unless the driver has changed.
+  auto& capabilities = candidate.capabilities;
+  bool cached = find_snapshot_device_capabilities(candidate.properties, capabilities);
+  if (cached) {
+    LOG_INFO("\t%s (from the capability snapshot)\n", candidate.properties.deviceName);
+  } else {
+    enumerate_device_capabilities(device, candidate.properties, capabilities);
+    sCapabilitySnapshotStale = true;
+  }
+  auto fulfillsRequirements = check_device_requirements(device, candidate.properties, capabilities, sDeviceRequirements);
+  LOG_INFO("\tdevice fulfills the requirements: %d\n", fulfillsRequirements ? 1 : 0);
+
+  // find the queue families for graphics and presentation and prefer a family
+  // which supports both of them to avoid sharing resources between queues.
+  const auto& queueFamilies = capabilities.queueFamilies;
+  for (auto i = 0u; i < queueFamilies.size(); i++) {
+    bool supportsGraphics = (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+    // in headless mode the graphics queue takes the role of the present queue.
+    VkBool32 presentSupport = false;
+    if (sHeadless) {
+      presentSupport = supportsGraphics;
+    } else {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, sSurface, &presentSupport);
+    }
+    if (!cached) {
+      LOG_DEBUG("\tqueue-family %d supports present:\t%d\n", i, presentSupport ? 1 : 0);
+    }
+
+    if (supportsGraphics && presentSupport) {
+      candidate.graphicsQueueFamilyIndex = i;
+      candidate.presentQueueFamilyIndex = i;
+      break;
+    }
+    if (supportsGraphics && candidate.graphicsQueueFamilyIndex < 0) {
+      candidate.graphicsQueueFamilyIndex = i;
+    }
+    if (presentSupport && candidate.presentQueueFamilyIndex < 0) {
+      candidate.presentQueueFamilyIndex = i;
+    }
+  }
+
+  // check whether the device fulfills all our requirements and score it.
+  candidate.suitable = fulfillsRequirements
+    && candidate.graphicsQueueFamilyIndex >= 0
+    && candidate.presentQueueFamilyIndex >= 0;
+  LOG_INFO("\tdevice is suitable: %d\n", candidate.suitable ? 1 : 0);
+  if (candidate.suitable) {
+    candidate.score = score_physical_device(device, candidate.properties, queueFamilies, candidate);
+  }
+  return candidate;
+}
+
+// ============================================================================
+// Find the candidate that the user has explicitly requested to be used.
+// @param candidates The list of all probed candidates.
+// @returns The index of the requested candidate or -1 if not found.
+static int find_overridden_physical_device(const std::vector<PhysicalDeviceCandidate>& candidates)
+{
+  // accept either a device index or a part of the device name.
+  char* end = nullptr;
+  auto index = strtol(sDeviceOverride.c_str(), &end, 10);
+  if (end != sDeviceOverride.c_str() && *end == '\0') {
+    return (index >= 0 && index < static_cast<long>(candidates.size())) ? static_cast<int>(index) : -1;
+  }
+  for (auto i = 0u; i < candidates.size(); i++) {
+    if (strstr(candidates[i].properties.deviceName, sDeviceOverride.c_str()) != nullptr) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+static void parallel_for(uint32_t count, uint32_t batchCount, const std::function<void(uint32_t, uint32_t, uint32_t)>& function);
+
+// ============================================================================
+
+static void select_vulkan_physical_device_and_queue_family()
+{
+  assert(sInstance != VK_NULL_HANDLE);
+  LOG_INFO("Selecting a physical device for Vulkan.\n");
+
+  // probe and score each of the available physical devices in parallel on the
+  // job workers, as the queries may need to wake up the devices and load parts
+  // of the drivers.
+  sDeviceRequirements = device_requirements();
+  auto devices = enumerate_physical_devices();
+  auto deviceCount = static_cast<uint32_t>(devices.size());
+  std::vector<PhysicalDeviceCandidate> candidates(deviceCount);
+  std::vector<std::vector<LogMessage>> messages(deviceCount);
+  parallel_for(deviceCount, deviceCount, [&](uint32_t batch, uint32_t begin, uint32_t end) {
+    (void) batch;
+    for (auto i = begin; i < end; i++) {
+      LogCapture capture(messages[i]);
+      candidates[i] = probe_physical_device(devices[i]);
+    }
+  });
+
+  // write out the messages of each device together in the enumeration order.
+  for (const auto& deviceMessages : messages) {
+    log_captured_messages(deviceMessages);
+  }
+  sDeviceCapabilities.clear();
+  for (const auto& candidate : candidates) {
+    sDeviceCapabilities.push_back(candidate.capabilities);
+  }
+
+  // use the device requested by the user or the device with the best score.
+  int selected = -1;
+  if (!sDeviceOverride.empty()) {
+    selected = find_overridden_physical_device(candidates);
+    if (selected < 0) {
+      LOG_ERROR("Unable to find the requested physical device: %s\n", sDeviceOverride.c_str());
+      exit_failure();
+    }
+    if (!candidates[selected].suitable) {
+      LOG_ERROR("The requested physical device is not suitable: %s\n", candidates[selected].properties.deviceName);
+      exit_failure();
+    }
+  } else {
+    for (auto i = 0u; i < candidates.size(); i++) {
+      if (candidates[i].suitable && (selected < 0 || candidates[i].score > candidates[selected].score)) {
+        selected = static_cast<int>(i);
+      }
+    }
+    if (selected < 0) {
+      LOG_ERROR("Unable to find a suitable physical device.\n");
+      exit_failure();
+    }
+  }
+
+  const auto& candidate = candidates[selected];
+  sPhysicalDevice = candidate.device;
+  sPhysicalDeviceProperties = candidate.properties;
+  sPhysicalDeviceCapabilities = candidate.capabilities;
+  sDeviceApiVersion = device_api_version(candidate.properties);
+  vkGetPhysicalDeviceMemoryProperties(sPhysicalDevice, &sPhysicalDeviceMemoryProperties);
+  sGraphicsQueueFamilyIndex = candidate.graphicsQueueFamilyIndex;
+  sPresentQueueFamilyIndex = candidate.presentQueueFamilyIndex;
+  LOG_INFO("Selected physical device [%d]: %s\n", selected, candidate.properties.deviceName);
+}
+
+// ============================================================================
+// LOGICAL DEVICES
+// ============================================================================
+// Vulkan seperates devices into physical and logical devices.
+//
+// Logical device is used as an application specific interface for the physical
+// interface, which is used to store application specific definitions in Vulkan.
+//
+// Same physical device can be used to create multiple logical devices. In our
+// testing environment example, we now only create a single logical device.
+// ============================================================================
+
+// Find a queue family that supports the required flags and none of the
+// excluded flags, preferring the family with the least amount of other flags.
+// @param queueFamilies The queue families of the physical device.
+// @param required The flags that the queue family must support.
+// @param excluded The flags that the queue family must not support.
+// @returns The index of the queue family or -1 if not found.
+static int find_dedicated_queue_family(const std::vector<VkQueueFamilyProperties>& queueFamilies,
+                                       VkQueueFlags required,
+                                       VkQueueFlags excluded)
+{
+  int found = -1;
+  for (auto i = 0u; i < queueFamilies.size(); i++) {
+    auto flags = queueFamilies[i].queueFlags;
+    if (queueFamilies[i].queueCount == 0 || (flags & required) != required || (flags & excluded) != 0) {
+      continue;
+    }
+    if (found < 0 || __builtin_popcount(flags) < __builtin_popcount(queueFamilies[found].queueFlags)) {
+      found = static_cast<int>(i);
+    }
+  }
+  return found;
+}
+
+// ============================================================================
+// Get the name of the specified queue role.
+// @param role The target queue role.
+// @returns The name of the queue role.
+static const char* queue_role_name(QueueRole role)
+{
+  switch (role)
+  {
+    case QUEUE_ROLE_GRAPHICS:
+      return "graphics";
+    case QUEUE_ROLE_PRESENT:
+      return "present";
+    case QUEUE_ROLE_COMPUTE:
+      return "compute";
+    case QUEUE_ROLE_TRANSFER:
+      return "transfer";
+    default:
+      return "unknown";
+  }
+}
+
+// ============================================================================
+// Get the device queue for the specified queue role.
+//
+// Roles may share a queue when the device lacks dedicated queue families, so
+// submissions into the returned queue must still be externally synchronized.
+//
+// @param role The target queue role.
+// @returns A handle to the device queue.
+static VkQueue get_queue(QueueRole role)
+{
+  assert(role < QUEUE_ROLE_COUNT);
+  assert(sQueues[role].queue != VK_NULL_HANDLE);
+  return sQueues[role].queue;
+}
+
+// ============================================================================
+
+static void create_logical_device()
+{
+  HostMemoryPhase phase("create_logical_device");
+  assert(sInstance != VK_NULL_HANDLE);
+  assert(sPhysicalDevice != VK_NULL_HANDLE);
+
+  // find the queue families for asynchronous compute and transfer operations.
+  // graphics families implicitly support transfers, so they are a fallback.
+  const auto& queueFamilies = sPhysicalDeviceCapabilities.queueFamilies;
+  int computeFamily = find_dedicated_queue_family(queueFamilies, VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
+  if (computeFamily < 0) {
+    computeFamily = sGraphicsQueueFamilyIndex;
+  }
+  int transferFamily = find_dedicated_queue_family(queueFamilies, VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+  if (transferFamily < 0) {
+    transferFamily = find_dedicated_queue_family(queueFamilies, VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT);
+  }
+  if (transferFamily < 0) {
+    transferFamily = computeFamily;
+  }
+
+  // assign a separate queue for each role as long as the family has queues
+  // left, otherwise let the role share the last queue of the family. the
+  // presentation shares the graphics queue whenever they're in same family.
+  std::vector<uint32_t> queueCounts(queueFamilies.size(), 0);
+  std::vector<std::vector<float>> queuePriorities(queueFamilies.size());
+  const int roleFamilies[QUEUE_ROLE_COUNT] = {
+    sGraphicsQueueFamilyIndex,
+    sPresentQueueFamilyIndex,
+    computeFamily,
+    transferFamily
+  };
+  for (int role = 0; role < QUEUE_ROLE_COUNT; role++) {
+    auto& info = sQueues[role];
+    info.familyIndex = static_cast<uint32_t>(roleFamilies[role]);
+    info.dedicated = role == QUEUE_ROLE_GRAPHICS || roleFamilies[role] != sGraphicsQueueFamilyIndex;
+    if (role == QUEUE_ROLE_PRESENT && info.familyIndex == sQueues[QUEUE_ROLE_GRAPHICS].familyIndex) {
+      info.queueIndex = sQueues[QUEUE_ROLE_GRAPHICS].queueIndex;
+      info.priority = sQueues[QUEUE_ROLE_GRAPHICS].priority;
+    } else if (queueCounts[info.familyIndex] < queueFamilies[info.familyIndex].queueCount) {
+      info.queueIndex = queueCounts[info.familyIndex]++;
+      info.priority = sQueuePriorities[role];
+      queuePriorities[info.familyIndex].push_back(info.priority);
+    } else {
+      info.queueIndex = queueCounts[info.familyIndex] - 1;
+      info.priority = queuePriorities[info.familyIndex].back();
+    }
+  }
+
+  // create a descriptor for the queues to be created for the device.
+  std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+  for (auto queueFamily = 0u; queueFamily < queueFamilies.size(); queueFamily++) {
+    if (queueCounts[queueFamily] == 0) {
+      continue;
+    }
+    VkDeviceQueueCreateInfo queueCreateInfo = {};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.pNext = NULL;
+    queueCreateInfo.flags = 0;
+    queueCreateInfo.queueFamilyIndex = queueFamily;
+    queueCreateInfo.queueCount = queueCounts[queueFamily];
+    queueCreateInfo.pQueuePriorities = queuePriorities[queueFamily].data();
+    queueCreateInfos.push_back(queueCreateInfo);
+  }
+
+  // enable the required features, which the device was selected to support,
+  // and the requested optional features which the device supports.
+  const auto& requirements = sDeviceRequirements;
+  const auto& supportedFeatures = sPhysicalDeviceCapabilities.device.features;
+  DeviceFeatureChain enabledFeatures = {};
+  for (const auto& requirement : requirements.coreFeatures) {
+    enabledFeatures.core.features.*requirement.feature = VK_TRUE;
+  }
+  sDeviceFeatures = 0;
+  for (int feature = 0; feature < DEVICE_FEATURE_COUNT; feature++) {
+    if (((sRequestedDeviceFeatures | requirements.features) & DEVICE_FEATURE_BIT(feature)) == 0) {
+      continue;
+    }
+    if (device_feature_supported(supportedFeatures, sDeviceApiVersion, static_cast<DeviceFeature>(feature))) {
+      DEVICE_FEATURES[feature].enable(enabledFeatures);
+      sDeviceFeatures |= DEVICE_FEATURE_BIT(feature);
+    } else {
+      LOG_WARNING("Skipping the unsupported device feature: %s\n", DEVICE_FEATURES[feature].name);
+    }
+  }
+
+  // create a descriptor for a new logical device. the feature chain replaces
+  // the core features whenever the device supports it.
+  VkDeviceCreateInfo createInfo;
+  createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  createInfo.pNext = NULL;
+  createInfo.flags = 0;
+  createInfo.pQueueCreateInfos = queueCreateInfos.data();
+  createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+  if (has_device_features2(sDeviceApiVersion)) {
+    link_device_features(enabledFeatures, sDeviceApiVersion);
+    createInfo.pNext = &enabledFeatures.core;
+    createInfo.pEnabledFeatures = NULL;
+  } else {
+    createInfo.pEnabledFeatures = &enabledFeatures.core.features;
+  }
+  auto deviceExtensions = requirements.extensions;
+  if (sUseTrace) {
+    // the calibrated timestamps are used to align the GPU zones in the trace.
+    if (has_capability(sPhysicalDeviceCapabilities.extensions, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME)) {
+      deviceExtensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+      sCalibratedTimestamps = true;
+    }
+  }
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  // device layers are deprecated, but older implementations still expect them.
+  createInfo.enabledLayerCount = static_cast<uint32_t>(sEnabledLayers.size());
+  createInfo.ppEnabledLayerNames = sEnabledLayers.empty() ? NULL : sEnabledLayers.data();
+
+  // try to create the logical device with the descriptor.
+  auto result = vkCreateDevice(sPhysicalDevice, &createInfo, host_allocator(), &sLogicalDevice);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkCreateDevice failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+  load_vulkan_device_functions();
+
+  // get the handles to the device queues of each queue role.
+  for (int role = 0; role < QUEUE_ROLE_COUNT; role++) {
+    auto& info = sQueues[role];
+    vkGetDeviceQueue(sLogicalDevice, info.familyIndex, info.queueIndex, &info.queue);
+    LOG_INFO("\t%s queue: family %d, index %d, priority %.2f%s\n",
+      queue_role_name(static_cast<QueueRole>(role)),
+      info.familyIndex,
+      info.queueIndex,
+      info.priority,
+      info.dedicated ? "" : " (shared with graphics family)");
+  }
+
+  LOG_INFO("Enabled [%d] optional device feature(s) with the API version %d.%d:\n",
+    __builtin_popcount(sDeviceFeatures),
+    VK_API_VERSION_MAJOR(sDeviceApiVersion),
+    VK_API_VERSION_MINOR(sDeviceApiVersion));
+  for (int feature = 0; feature < DEVICE_FEATURE_COUNT; feature++) {
+    if (has_device_feature(static_cast<DeviceFeature>(feature))) {
+      LOG_INFO("\t%s\n", DEVICE_FEATURES[feature].name);
+    }
+  }
+  LOG_INFO("Created a new Vulkan logical device for the application.\n");
+}
+
+// ============================================================================
+// PIPELINE CACHE
+// ============================================================================
+// Vulkan allows applications to store the results of pipeline compilation in
+// a pipeline cache object, which can then be serialized and reused later.
+//
+// The data retrieved from a pipeline cache begins with a header, which holds
+// the vendor and device identifiers and the pipeline cache UUID of the device
+// that produced it. Drivers may silently reject mismatching data, but we also
+// wrap the data with our own header so that stale or corrupted files can be
+// detected before they are ever passed to the driver.
+//
+//   1. Memory map the cache file (if any) and validate both of the headers.
+//   2. Create the pipeline cache with the mapped data as the initial data.
+//   3. On shutdown, write the cache data into a temporary file and atomically
+//      replace the previous cache file with it.
+// ============================================================================
+
+// The magic number to identify our pipeline cache files ("VKPC").
+static const uint32_t PIPELINE_CACHE_MAGIC = 0x43504B56;
+// The version of our pipeline cache file format.
+static const uint32_t PIPELINE_CACHE_VERSION = 1;
+
+// A header that precedes the pipeline cache data in the cache file.
+struct PipelineCacheFileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+  uint64_t dataSize;
+  uint64_t dataHash;
+};
+
+// A header that Vulkan places at the beginning of the pipeline cache data.
+struct PipelineCacheDataHeader
+{
+  uint32_t headerSize;
+  uint32_t headerVersion;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+// ============================================================================
+// Check whether the cache file contents were produced by the selected device.
+// @param data The memory mapped contents of the cache file.
+// @param size The size of the cache file in bytes.
+// @returns true if the contents can be passed to the driver.
+static bool validate_pipeline_cache_file(const uint8_t* data, size_t size)
+{
+  const auto& properties = sPhysicalDeviceProperties;
+
+  // validate our own header which wraps the pipeline cache data.
+  if (size < sizeof(PipelineCacheFileHeader)) {
+    LOG_WARNING("\tpipeline cache file is truncated.\n");
+    return false;
+  }
+  PipelineCacheFileHeader fileHeader;
+  memcpy(&fileHeader, data, sizeof(fileHeader));
+  if (fileHeader.magic != PIPELINE_CACHE_MAGIC || fileHeader.version != PIPELINE_CACHE_VERSION) {
+    LOG_WARNING("\tpipeline cache file has an unknown format.\n");
+    return false;
+  }
+  if (fileHeader.vendorID != properties.vendorID
+    || fileHeader.deviceID != properties.deviceID
+    || fileHeader.driverVersion != properties.driverVersion
+    || memcmp(fileHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+    LOG_WARNING("\tpipeline cache file was created for another device or driver.\n");
+    return false;
+  }
+  if (fileHeader.dataSize != size - sizeof(PipelineCacheFileHeader)) {
+    LOG_WARNING("\tpipeline cache file has an invalid data size.\n");
+    return false;
+  }
+  const uint8_t* cacheData = data + sizeof(PipelineCacheFileHeader);
+  if (fileHeader.dataHash != hash_bytes(cacheData, fileHeader.dataSize)) {
+    LOG_WARNING("\tpipeline cache file has an invalid checksum.\n");
+    return false;
+  }
+
+  // validate the header which Vulkan has placed in front of the cache data.
+  PipelineCacheDataHeader dataHeader;
+  if (fileHeader.dataSize < sizeof(dataHeader)) {
+    LOG_WARNING("\tpipeline cache data is truncated.\n");
+    return false;
+  }
+  memcpy(&dataHeader, cacheData, sizeof(dataHeader));
+  if (dataHeader.headerSize < sizeof(dataHeader)
+    || dataHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+    || dataHeader.vendorID != properties.vendorID
+    || dataHeader.deviceID != properties.deviceID
+    || memcmp(dataHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+    LOG_WARNING("\tpipeline cache data has an invalid header.\n");
+    return false;
+  }
+  return true;
+}
+
+// ============================================================================
+
+static void create_pipeline_cache()
+{
+  HostMemoryPhase phase("create_pipeline_cache");
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+  auto startTime = std::chrono::steady_clock::now();
+
+  // try to memory map the pipeline cache file from the previous run.
+  MappedFile file;
+  bool hasFile = map_file(PIPELINE_CACHE_FILE, file);
+
+  // only pass the cached data to the driver when it was made for this device.
+  VkPipelineCacheCreateInfo createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  createInfo.pNext = NULL;
+  createInfo.flags = 0;
+  if (hasFile && validate_pipeline_cache_file(file.data, file.size)) {
+    createInfo.initialDataSize = file.size - sizeof(PipelineCacheFileHeader);
+    createInfo.pInitialData = file.data + sizeof(PipelineCacheFileHeader);
+  }
+
+  // try to create the pipeline cache with the descriptor.
+  auto result = vkCreatePipelineCache(sLogicalDevice, &createInfo, host_allocator(), &sPipelineCache);
+
+  // the driver has copied the initial data so the file can be released.
+  unmap_file(file);
+
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkCreatePipelineCache failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+  LOG_INFO("Created a %s pipeline cache with [%d] bytes of initial data in %.3f ms.\n",
+    createInfo.initialDataSize > 0 ? "warm" : "cold",
+    static_cast<int>(createInfo.initialDataSize),
+    milliseconds_since(startTime));
+}
+
+// ============================================================================
+
+static void save_pipeline_cache()
+{
+  TraceZone zone("save_pipeline_cache");
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+  assert(sPipelineCache != VK_NULL_HANDLE);
+
+  // calculate how much data the pipeline cache contains.
+  size_t dataSize = 0;
+  auto result = vkGetPipelineCacheData(sLogicalDevice, sPipelineCache, &dataSize, NULL);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkGetPipelineCacheData failed: %s\n", vulkan_result_description(result).c_str());
+    return;
+  }
+  if (dataSize == 0) {
+    return;
+  }
+
+  // get the pipeline cache data right after our own file header.
+  std::vector<uint8_t> data(sizeof(PipelineCacheFileHeader) + dataSize);
+  result = vkGetPipelineCacheData(sLogicalDevice, sPipelineCache, &dataSize, data.data() + sizeof(PipelineCacheFileHeader));
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkGetPipelineCacheData failed: %s\n", vulkan_result_description(result).c_str());
+    return;
+  }
+  data.resize(sizeof(PipelineCacheFileHeader) + dataSize);
+
+  // fill our own file header with the identifiers of the device.
+  PipelineCacheFileHeader header = {};
+  header.magic = PIPELINE_CACHE_MAGIC;
+  header.version = PIPELINE_CACHE_VERSION;
+  header.vendorID = sPhysicalDeviceProperties.vendorID;
+  header.deviceID = sPhysicalDeviceProperties.deviceID;
+  header.driverVersion = sPhysicalDeviceProperties.driverVersion;
+  memcpy(header.pipelineCacheUUID, sPhysicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+  header.dataSize = dataSize;
+  header.dataHash = hash_bytes(data.data() + sizeof(header), dataSize);
+  memcpy(data.data(), &header, sizeof(header));
+
+  // write into a temporary file so a crash never leaves a partial cache file.
+  if (!write_file_atomically(PIPELINE_CACHE_FILE, data.data(), data.size())) {
+    return;
+  }
+  LOG_INFO("Saved [%d] bytes of pipeline cache data.\n", static_cast<int>(dataSize));
+}
+
+// ============================================================================
+// DEVICE MEMORY
+// ============================================================================
+// Device memory is allocated with vkAllocateMemory, but each allocation is
+// expensive and the amount of allocations is limited by the device limit
+// maxMemoryAllocationCount (which can be as low as 4096). So instead of using
+// a separate allocation for each resource, we allocate large blocks for each
+// memory type and sub-allocate resources from them.
+//
+// Each block is managed with a two-level segregated fit (TLSF) allocator. Free
+// ranges are kept in segregated lists indexed by a first level (power of two)
+// and a second level (linear subdivision of the power of two) and the non-empty
+// lists are tracked with bitmaps, so both allocation and release are O(1).
+// Released ranges are immediately merged with their free neighbours.
+//
+// Some device limits must be respected while sub-allocating.
+//
+//   1. bufferImageGranularity: linear resources (buffers) and optimal images
+//      must not share a "page" of this size. Ranges of optimal images are
+//      aligned and padded to the granularity, so they never share a page.
+//   2. nonCoherentAtomSize: ranges in host visible but non-coherent memory are
+//      aligned and padded to the atom size, so that flushing a range never
+//      touches the data of a neighbour.
+// ============================================================================
+
+// The default size of the device memory blocks.
+#define DEVICE_MEMORY_BLOCK_SIZE (64ull * 1024ull * 1024ull)
+// The base-two logarithm of the amount of second level lists in the TLSF.
+#define TLSF_SL_SHIFT 4
+// The amount of second level lists in the TLSF.
+#define TLSF_SL_COUNT (1 << TLSF_SL_SHIFT)
+// The smallest unit of allocation in the TLSF.
+#define TLSF_MIN_ALIGNMENT 16ull
+// The sizes below this are all mapped into the first level zero.
+#define TLSF_SMALL_SIZE (TLSF_MIN_ALIGNMENT * TLSF_SL_COUNT)
+// The amount of first level lists in the TLSF.
+#define TLSF_FL_COUNT 48
+// An invalid TLSF node index.
+#define TLSF_NONE 0xffffffffu
+
+// A range of memory in a TLSF allocator, which is either free or in use.
+struct TlsfNode
+{
+  VkDeviceSize offset;
+  VkDeviceSize size;
+  uint32_t prevPhysical;
+  uint32_t nextPhysical;
+  uint32_t prevFree;
+  uint32_t nextFree;
+  bool     free;
+};
+
+// A two-level segregated fit allocator for a single device memory block.
+struct Tlsf
+{
+  uint64_t flBitmap;
+  uint32_t slBitmaps[TLSF_FL_COUNT];
+  uint32_t freeLists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+  std::vector<TlsfNode> nodes;
+  std::vector<uint32_t> unusedNodes;
+};
+
+// A device memory block from which the resources are sub-allocated.
+struct DeviceMemoryBlock
+{
+  VkDeviceMemory memory;
+  VkDeviceSize   size;
+  VkDeviceSize   used;
+  uint8_t*       mapped;
+  Tlsf           tlsf;
+};
+
+// The device memory blocks of a single memory type.
+struct DeviceMemoryPool
+{
+  std::mutex mutex;
+  std::vector<DeviceMemoryBlock*> blocks;
+};
+
+// The device memory pools for each of the memory types.
+static DeviceMemoryPool sDeviceMemoryPools[VK_MAX_MEMORY_TYPES];
+
+// ============================================================================
+// Get the index of the most significant set bit.
+// @param value The target value (must not be zero).
+// @returns The index of the most significant set bit.
+static int tlsf_fls(uint64_t value)
+{
+  return 63 - __builtin_clzll(value);
+}
+
+// ============================================================================
+// Map the size into the first and second level list indices.
+// @param size The size of the range.
+// @param fl The first level index.
+// @param sl The second level index.
+static void tlsf_mapping(VkDeviceSize size, int& fl, int& sl)
+{
+  if (size < TLSF_SMALL_SIZE) {
+    fl = 0;
+    sl = static_cast<int>(size / TLSF_MIN_ALIGNMENT);
+  } else {
+    int bit = tlsf_fls(size);
+    sl = static_cast<int>((size >> (bit - TLSF_SL_SHIFT)) ^ (1ull << TLSF_SL_SHIFT));
+    fl = bit - tlsf_fls(TLSF_SMALL_SIZE) + 1;
+  }
+}
+
+// ============================================================================
+// Get the size of the smallest list whose every node fits an aligned range.
+// @param size The size of the range (a multiple of TLSF_MIN_ALIGNMENT).
+// @param alignment The alignment of the range (a power of two).
+// @returns The size rounded up to the next list boundary.
+static VkDeviceSize tlsf_search_size(VkDeviceSize size, VkDeviceSize alignment)
+{
+  VkDeviceSize searchSize = size + (alignment > TLSF_MIN_ALIGNMENT ? alignment - TLSF_MIN_ALIGNMENT : 0);
+  if (searchSize >= TLSF_SMALL_SIZE) {
+    VkDeviceSize step = 1ull << (tlsf_fls(searchSize) - TLSF_SL_SHIFT);
+    searchSize = (searchSize + step - 1) & ~(step - 1);
+  }
+  return searchSize;
+}
+
+// ============================================================================
+// Get a new node from the TLSF node storage.
+// @param tlsf The target TLSF.
+// @returns The index of the node.
+static uint32_t tlsf_new_node(Tlsf& tlsf)
+{
+  if (!tlsf.unusedNodes.empty()) {
+    auto node = tlsf.unusedNodes.back();
+    tlsf.unusedNodes.pop_back();
+    return node;
+  }
+  tlsf.nodes.push_back(TlsfNode());
+  return static_cast<uint32_t>(tlsf.nodes.size() - 1);
+}
+
+// ============================================================================
+// Insert a free node into the free list matching its size.
+// @param tlsf The target TLSF.
+// @param index The index of the node.
+static void tlsf_insert_free(Tlsf& tlsf, uint32_t index)
+{
+  auto& node = tlsf.nodes[index];
+  int fl, sl;
+  tlsf_mapping(node.size, fl, sl);
+  node.free = true;
+  node.prevFree = TLSF_NONE;
+  node.nextFree = tlsf.freeLists[fl][sl];
+  if (node.nextFree != TLSF_NONE) {
+    tlsf.nodes[node.nextFree].prevFree = index;
+  }
+  tlsf.freeLists[fl][sl] = index;
+  tlsf.flBitmap |= 1ull << fl;
+  tlsf.slBitmaps[fl] |= 1u << sl;
+}
+
+// ============================================================================
+// Remove a free node from its free list.
+// @param tlsf The target TLSF.
+// @param index The index of the node.
+static void tlsf_remove_free(Tlsf& tlsf, uint32_t index)
+{
+  auto& node = tlsf.nodes[index];
+  int fl, sl;
+  tlsf_mapping(node.size, fl, sl);
+  if (node.prevFree != TLSF_NONE) {
+    tlsf.nodes[node.prevFree].nextFree = node.nextFree;
+  } else {
+    tlsf.freeLists[fl][sl] = node.nextFree;
+    if (node.nextFree == TLSF_NONE) {
+      tlsf.slBitmaps[fl] &= ~(1u << sl);
+      if (tlsf.slBitmaps[fl] == 0) {
+        tlsf.flBitmap &= ~(1ull << fl);
+      }
+    }
+  }
+  if (node.nextFree != TLSF_NONE) {
+    tlsf.nodes[node.nextFree].prevFree = node.prevFree;
+  }
+  node.free = false;
+}
+
+// ============================================================================
+// Split the node so that it has the specified size and the remainder becomes
+// a new free node right after it.
+// @param tlsf The target TLSF.
+// @param index The index of the node to be split.
+// @param size The new size of the node.
+static void tlsf_split(Tlsf& tlsf, uint32_t index, VkDeviceSize size)
+{
+  auto remainder = tlsf_new_node(tlsf);
+  auto& node = tlsf.nodes[index];
+  auto& rest = tlsf.nodes[remainder];
+  rest.offset = node.offset + size;
+  rest.size = node.size - size;
+  rest.prevPhysical = index;
+  rest.nextPhysical = node.nextPhysical;
+  if (node.nextPhysical != TLSF_NONE) {
+    tlsf.nodes[node.nextPhysical].prevPhysical = remainder;
+  }
+  node.nextPhysical = remainder;
+  node.size = size;
+  tlsf_insert_free(tlsf, remainder);
+}
+
+// ============================================================================
+// Merge the node with the physically next node, which is then released.
+// @param tlsf The target TLSF.
+// @param index The index of the node which absorbs its next neighbour.
+static void tlsf_merge_next(Tlsf& tlsf, uint32_t index)
+{
+  auto& node = tlsf.nodes[index];
+  auto next = node.nextPhysical;
+  auto& nextNode = tlsf.nodes[next];
+  node.size += nextNode.size;
+  node.nextPhysical = nextNode.nextPhysical;
+  if (nextNode.nextPhysical != TLSF_NONE) {
+    tlsf.nodes[nextNode.nextPhysical].prevPhysical = index;
+  }
+  tlsf.unusedNodes.push_back(next);
+}
+
+// ============================================================================
+// Initialize the TLSF to manage a single free range of the specified size.
+// @param tlsf The target TLSF.
+// @param size The size of the managed range.
+static void tlsf_init(Tlsf& tlsf, VkDeviceSize size)
+{
+  tlsf.flBitmap = 0;
+  memset(tlsf.slBitmaps, 0, sizeof(tlsf.slBitmaps));
+  memset(tlsf.freeLists, 0xff, sizeof(tlsf.freeLists));
+  tlsf.nodes.clear();
+  tlsf.unusedNodes.clear();
+
+  auto index = tlsf_new_node(tlsf);
+  auto& node = tlsf.nodes[index];
+  node.offset = 0;
+  node.size = size;
+  node.prevPhysical = TLSF_NONE;
+  node.nextPhysical = TLSF_NONE;
+  tlsf_insert_free(tlsf, index);
+}
+
+// ============================================================================
+// Allocate an aligned range from the TLSF.
+// @param tlsf The target TLSF.
+// @param size The size of the range (a multiple of TLSF_MIN_ALIGNMENT).
+// @param alignment The alignment of the range (a power of two).
+// @returns The index of the allocated node or TLSF_NONE if out of memory.
+static uint32_t tlsf_allocate(Tlsf& tlsf, VkDeviceSize size, VkDeviceSize alignment)
+{
+  // round the search size up to the next list so any node in it will fit.
+  int fl, sl;
+  tlsf_mapping(tlsf_search_size(size, alignment), fl, sl);
+  if (fl >= TLSF_FL_COUNT) {
+    return TLSF_NONE;
+  }
+
+  // find the first non-empty list at or above the mapped list.
+  uint32_t slMap = tlsf.slBitmaps[fl] & (~0u << sl);
+  if (slMap == 0) {
+    uint64_t flMap = fl + 1 < 64 ? tlsf.flBitmap & (~0ull << (fl + 1)) : 0;
+    if (flMap == 0) {
+      return TLSF_NONE;
+    }
+    fl = __builtin_ctzll(flMap);
+    slMap = tlsf.slBitmaps[fl];
+  }
+  sl = __builtin_ctz(slMap);
+  auto index = tlsf.freeLists[fl][sl];
+  tlsf_remove_free(tlsf, index);
+
+  // return the padding in front of the aligned offset into the free lists.
+  auto offset = tlsf.nodes[index].offset;
+  auto padding = ((offset + alignment - 1) & ~(alignment - 1)) - offset;
+  if (padding > 0) {
+    tlsf_split(tlsf, index, padding);
+    auto front = index;
+    index = tlsf.nodes[front].nextPhysical;
+    tlsf_remove_free(tlsf, index);
+    tlsf_insert_free(tlsf, front);
+  }
+
+  // return the remainder after the range into the free lists.
+  if (tlsf.nodes[index].size > size) {
+    tlsf_split(tlsf, index, size);
+  }
+  return index;
+}
+
+// ============================================================================
+// Release a range into the TLSF and merge it with its free neighbours.
+// @param tlsf The target TLSF.
+// @param index The index of the allocated node.
+static void tlsf_free(Tlsf& tlsf, uint32_t index)
+{
+  auto next = tlsf.nodes[index].nextPhysical;
+  if (next != TLSF_NONE && tlsf.nodes[next].free) {
+    tlsf_remove_free(tlsf, next);
+    tlsf_merge_next(tlsf, index);
+  }
+  auto prev = tlsf.nodes[index].prevPhysical;
+  if (prev != TLSF_NONE && tlsf.nodes[prev].free) {
+    tlsf_remove_free(tlsf, prev);
+    tlsf_merge_next(tlsf, prev);
+    index = prev;
+  }
+  tlsf_insert_free(tlsf, index);
+}
+
+// ============================================================================
+// Find a memory type which is allowed by the mask and has the properties.
+// @param memoryTypeBits The mask of allowed memory types.
+// @param properties The required memory properties.
+// @returns The index of the memory type or -1 if not found.
+static int find_memory_type(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties)
+{
+  const auto& memoryProperties = sPhysicalDeviceMemoryProperties;
+  for (auto i = 0u; i < memoryProperties.memoryTypeCount; i++) {
+    bool allowed = (memoryTypeBits & (1u << i)) != 0;
+    if (allowed && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+// ============================================================================
+// Create a new device memory block for the specified memory type.
+// @param memoryType The index of the memory type.
+// @param size The size of the block.
+// @returns The new block or nullptr if the device is out of memory.
+static DeviceMemoryBlock* create_device_memory_block(uint32_t memoryType, VkDeviceSize size)
+{
+  VkMemoryAllocateInfo allocateInfo = {};
+  allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocateInfo.pNext = NULL;
+  allocateInfo.allocationSize = size;
+  allocateInfo.memoryTypeIndex = memoryType;
+
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  auto result = vkAllocateMemory(sLogicalDevice, &allocateInfo, host_allocator(), &memory);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkAllocateMemory failed: %s\n", vulkan_result_description(result).c_str());
+    return nullptr;
+  }
+
+  // keep host visible blocks persistently mapped.
+  void* mapped = nullptr;
+  auto flags = sPhysicalDeviceMemoryProperties.memoryTypes[memoryType].propertyFlags;
+  if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0) {
+    result = vkMapMemory(sLogicalDevice, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkMapMemory failed: %s\n", vulkan_result_description(result).c_str());
+      vkFreeMemory(sLogicalDevice, memory, host_allocator());
+      return nullptr;
+    }
+  }
+
+  auto block = new DeviceMemoryBlock();
+  block->memory = memory;
+  block->size = size;
+  block->used = 0;
+  block->mapped = static_cast<uint8_t*>(mapped);
+  tlsf_init(block->tlsf, size);
+  return block;
+}
+
+// ============================================================================
+// Release the device memory block.
+// @param block The block to be released.
+static void destroy_device_memory_block(DeviceMemoryBlock* block)
+{
+  if (block->mapped != nullptr) {
+    vkUnmapMemory(sLogicalDevice, block->memory);
+  }
+  vkFreeMemory(sLogicalDevice, block->memory, host_allocator());
+  delete block;
+}
+
+// ============================================================================
+// Sub-allocate device memory for a resource.
+// @param requirements The memory requirements of the resource.
+// @param properties The required memory properties.
+// @param optimalImage Whether the resource is an image with optimal tiling.
+// @param allocation The allocation to be filled.
+// @returns true if the memory was allocated.
+static bool allocate_device_memory(const VkMemoryRequirements& requirements,
+                                   VkMemoryPropertyFlags properties,
+                                   bool optimalImage,
+                                   DeviceAllocation& allocation)
+{
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+  int memoryType = find_memory_type(requirements.memoryTypeBits, properties);
+  if (memoryType < 0) {
+    return false;
+  }
+
+  // respect the device limits and the allocation unit of the TLSF.
+  const auto& limits = sPhysicalDeviceProperties.limits;
+  auto flags = sPhysicalDeviceMemoryProperties.memoryTypes[memoryType].propertyFlags;
+  VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, TLSF_MIN_ALIGNMENT);
+  if (optimalImage) {
+    alignment = std::max(alignment, limits.bufferImageGranularity);
+  }
+  bool nonCoherent = (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0 && (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0;
+  if (nonCoherent) {
+    alignment = std::max(alignment, limits.nonCoherentAtomSize);
+  }
+  VkDeviceSize size = (requirements.size + alignment - 1) & ~(alignment - 1);
+
+  // use a dedicated block for resources which would fill most of a block. The
+  // dedicated block is sized to the list boundary the TLSF will search from.
+  auto heapIndex = sPhysicalDeviceMemoryProperties.memoryTypes[memoryType].heapIndex;
+  auto heapSize = sPhysicalDeviceMemoryProperties.memoryHeaps[heapIndex].size;
+  VkDeviceSize blockSize = std::min<VkDeviceSize>(DEVICE_MEMORY_BLOCK_SIZE, std::max<VkDeviceSize>(heapSize / 8, TLSF_SMALL_SIZE));
+  blockSize &= ~(TLSF_MIN_ALIGNMENT - 1);
+  if (size > blockSize / 2) {
+    blockSize = tlsf_search_size(size, alignment);
+  }
+
+  // try to sub-allocate from the existing blocks and create a new block if needed.
+  auto& pool = sDeviceMemoryPools[memoryType];
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  uint32_t node = TLSF_NONE;
+  uint32_t blockIndex = 0;
+  for (; blockIndex < pool.blocks.size(); blockIndex++) {
+    node = tlsf_allocate(pool.blocks[blockIndex]->tlsf, size, alignment);
+    if (node != TLSF_NONE) {
+      break;
+    }
+  }
+  if (node == TLSF_NONE) {
+    auto block = create_device_memory_block(static_cast<uint32_t>(memoryType), blockSize);
+    if (block == nullptr) {
+      return false;
+    }
+    node = tlsf_allocate(block->tlsf, size, alignment);
+    if (node == TLSF_NONE) {
+      LOG_ERROR("Unable to allocate %llu bytes from a new device memory block.\n", static_cast<unsigned long long>(size));
+      destroy_device_memory_block(block);
+      return false;
+    }
+    pool.blocks.push_back(block);
+    blockIndex = static_cast<uint32_t>(pool.blocks.size() - 1);
+  }
+
+  auto block = pool.blocks[blockIndex];
+  const auto& tlsfNode = block->tlsf.nodes[node];
+  block->used += tlsfNode.size;
+  allocation.memory = block->memory;
+  allocation.offset = tlsfNode.offset;
+  allocation.size = tlsfNode.size;
+  allocation.mapped = block->mapped != nullptr ? block->mapped + tlsfNode.offset : nullptr;
+  allocation.memoryType = static_cast<uint32_t>(memoryType);
+  allocation.block = blockIndex;
+  allocation.node = node;
+  return true;
+}
+
+// ============================================================================
+// Release sub-allocated device memory. An empty block is only released when
+// it is the last block of the memory type (which keeps the block indices of
+// other allocations stable) and not the only one (which avoids thrashing).
+// @param allocation The allocation to be released.
+static void free_device_memory(DeviceAllocation& allocation)
+{
+  if (allocation.memory == VK_NULL_HANDLE) {
+    return;
+  }
+  auto& pool = sDeviceMemoryPools[allocation.memoryType];
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  auto block = pool.blocks[allocation.block];
+  assert(block->memory == allocation.memory);
+  block->used -= block->tlsf.nodes[allocation.node].size;
+  tlsf_free(block->tlsf, allocation.node);
+  if (block->used == 0 && allocation.block + 1 == pool.blocks.size() && pool.blocks.size() > 1) {
+    destroy_device_memory_block(block);
+    pool.blocks.pop_back();
+  }
+  allocation = {};
+}
+
+// ============================================================================
+
+static void destroy_device_memory()
+{
+  for (auto& pool : sDeviceMemoryPools) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    for (auto block : pool.blocks) {
+      if (block->used > 0) {
+        LOG_WARNING("Device memory block still has [%llu] bytes in use.\n", static_cast<unsigned long long>(block->used));
+      }
+      destroy_device_memory_block(block);
+    }
+    pool.blocks.clear();
+  }
+}
+
+// ============================================================================
+// Measure the cost of sub-allocation against raw vkAllocateMemory calls by
+// allocating and releasing the same set of randomly sized ranges with both.
+static void benchmark_device_memory()
+{
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+  HostMemoryPhase phase("benchmark_device_memory");
+  TraceZone zone("benchmark_device_memory");
+
+  // stay well below the maximum amount of allocations of the device.
+  const auto maxAllocations = sPhysicalDeviceProperties.limits.maxMemoryAllocationCount;
+  const uint32_t count = std::min<uint32_t>(1024, maxAllocations / 2);
+  const int rounds = 8;
+
+  int memoryType = find_memory_type(~0u, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  if (memoryType < 0) {
+    memoryType = 0;
+  }
+  std::minstd_rand random(1234);
+  std::vector<VkMemoryRequirements> requirements(count);
+  for (auto& requirement : requirements) {
+    requirement.size = 4096 * (1 + random() % 64);
+    requirement.alignment = 256;
+    requirement.memoryTypeBits = 1u << memoryType;
+  }
+  LOG_INFO("Benchmarking [%d] device memory allocations (4 KiB ... 256 KiB) for [%d] rounds.\n", count, rounds);
+
+  // measure raw allocations where each range is a separate device memory.
+  std::vector<VkDeviceMemory> memories(count, VK_NULL_HANDLE);
+  double rawAllocate = 0.0;
+  double rawFree = 0.0;
+  for (int round = 0; round < rounds; round++) {
+    auto startTime = std::chrono::steady_clock::now();
+    for (auto i = 0u; i < count; i++) {
+      VkMemoryAllocateInfo allocateInfo = {};
+      allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      allocateInfo.pNext = NULL;
+      allocateInfo.allocationSize = requirements[i].size;
+      allocateInfo.memoryTypeIndex = static_cast<uint32_t>(memoryType);
+      auto result = vkAllocateMemory(sLogicalDevice, &allocateInfo, host_allocator(), &memories[i]);
+      if (result != VK_SUCCESS) {
+        LOG_ERROR("vkAllocateMemory failed: %s\n", vulkan_result_description(result).c_str());
+        exit_failure();
+      }
+    }
+    rawAllocate += milliseconds_since(startTime);
+    startTime = std::chrono::steady_clock::now();
+    for (auto memory : memories) {
+      vkFreeMemory(sLogicalDevice, memory, host_allocator());
+    }
+    rawFree += milliseconds_since(startTime);
+  }
+
+  // measure sub-allocations from the shared device memory blocks.
+  std::vector<DeviceAllocation> allocations(count);
+  double subAllocate = 0.0;
+  double subFree = 0.0;
+  for (int round = 0; round < rounds; round++) {
+    auto startTime = std::chrono::steady_clock::now();
+    for (auto i = 0u; i < count; i++) {
+      if (!allocate_device_memory(requirements[i], 0, false, allocations[i])) {
+        LOG_ERROR("Unable to sub-allocate device memory.\n");
+        exit_failure();
+      }
+    }
+    subAllocate += milliseconds_since(startTime);
+    startTime = std::chrono::steady_clock::now();
+    for (auto& allocation : allocations) {
+      free_device_memory(allocation);
+    }
+    subFree += milliseconds_since(startTime);
+  }
+
+  const double operations = static_cast<double>(count) * rounds;
+  LOG_INFO("\tvkAllocateMemory:\t%10.3f us/alloc %10.3f us/free\n", rawAllocate * 1000.0 / operations, rawFree * 1000.0 / operations);
+  LOG_INFO("\tsub-allocator:\t\t%10.3f us/alloc %10.3f us/free\n", subAllocate * 1000.0 / operations, subFree * 1000.0 / operations);
+  LOG_INFO("\tspeedup:\t\t%10.1fx alloc %10.1fx free\n",
+    rawAllocate / std::max(subAllocate, 1e-9),
+    rawFree / std::max(subFree, 1e-9));
+}
+
+// ============================================================================
+// OFFSCREEN IMAGES
+// ============================================================================
+// In headless mode there is no window, surface or swapchain. Instead of the
+// swapchain images we create a set of offscreen color images, which are used
+// as the render targets. This allows running the full device and queue setup
+// on machines without a display (e.g. with a CPU implementation like lavapipe).
+//
+// Each frame in flight owns an offscreen image, so that a frame never renders
+// into an image that the device may still be using for another frame.
+// ============================================================================
+
+// ============================================================================
+
+static void create_offscreen_images()
+{
+  TraceZone zone("create_offscreen_images");
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+
+  for (uint32_t i = 0; i < sFramesInFlight; i++) {
+    // create a descriptor for a color image that can be rendered and copied.
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.pNext = NULL;
+    imageInfo.flags = 0;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = OFFSCREEN_IMAGE_FORMAT;
+    imageInfo.extent.width = OFFSCREEN_IMAGE_WIDTH;
+    imageInfo.extent.height = OFFSCREEN_IMAGE_HEIGHT;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkImage image = VK_NULL_HANDLE;
+    auto result = vkCreateImage(sLogicalDevice, &imageInfo, host_allocator(), &image);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkCreateImage failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+    sOffscreenImages.push_back(image);
+
+    // sub-allocate and bind device local memory for the image.
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(sLogicalDevice, image, &requirements);
+    DeviceAllocation memory = {};
+    if (!allocate_device_memory(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, memory)
+      && !allocate_device_memory(requirements, 0, true, memory)) {
+      LOG_ERROR("Unable to allocate device memory for an offscreen image.\n");
+      exit_failure();
+    }
+    sOffscreenImageMemories.push_back(memory);
+
+    result = vkBindImageMemory(sLogicalDevice, image, memory.memory, memory.offset);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkBindImageMemory failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+
+    // create a view so the image can be used as a color attachment.
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.pNext = NULL;
+    viewInfo.flags = 0;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = imageInfo.format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    VkImageView view = VK_NULL_HANDLE;
+    result = vkCreateImageView(sLogicalDevice, &viewInfo, host_allocator(), &view);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkCreateImageView failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+    sOffscreenImageViews.push_back(view);
+  }
+  LOG_INFO("Created [%d] offscreen images (%dx%d) for headless rendering.\n",
+    sFramesInFlight, OFFSCREEN_IMAGE_WIDTH, OFFSCREEN_IMAGE_HEIGHT);
+}
+
+// ============================================================================
+
+static void destroy_offscreen_images()
+{
+  for (auto view : sOffscreenImageViews) {
+    vkDestroyImageView(sLogicalDevice, view, host_allocator());
+  }
+  for (auto image : sOffscreenImages) {
+    vkDestroyImage(sLogicalDevice, image, host_allocator());
+  }
+  for (auto& memory : sOffscreenImageMemories) {
+    free_device_memory(memory);
+  }
+  sOffscreenImageViews.clear();
+  sOffscreenImages.clear();
+  sOffscreenImageMemories.clear();
+}
+
+// ============================================================================
+// WINDOW SURFACES
+// ============================================================================
+// A window surface connects Vulkan with the window of the platform. Surfaces
+// are only created when running with a window (i.e. not in headless mode).
+// ============================================================================
+
+#ifdef _WIN32
+static void create_window_surface()
+{
+  // create a descriptor to create a Vulkan window surface.
+  VkWin32SurfaceCreateInfoKHR createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+  createInfo.hwnd = sHWND;
+  createInfo.hinstance = GetModuleHandle(nullptr);
+
+  // the function is resolved with the instance functions.
+  if (!vkCreateWin32SurfaceKHR) {
+    LOG_ERROR("Unable to find the Vulkan function vkCreateWin32SurfaceKHR.\n");
+    exit_failure();
+  }
+
+  // try to create a new window surface.
+  auto result = vkCreateWin32SurfaceKHR(sInstance, &createInfo, host_allocator(), &sSurface);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkCreateWin32SurfaceKHR failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+  LOG_INFO("Create a new window surface for the application.\n");
+}
+#endif
+
+// ============================================================================
+// SWAPCHAIN
+// ============================================================================
+// A swapchain is a queue of images that are presented into a window surface.
+//
+// The presentation mode defines how the images are queued for the display and
+// it has a direct impact on the latency between input and the displayed image.
+//
+//   MAILBOX      Only the newest image is queued and older ones are replaced,
+//                so rendering never blocks and there's no tearing.
+//   IMMEDIATE    Images are displayed immediately, which may cause tearing.
+//   FIFO         Images are queued and displayed on vertical blank. This is
+//                always supported, but with the longest latency.
+//
+// We prefer MAILBOX (or IMMEDIATE) for low latency and fall back to FIFO. With
+// three images (triple buffering) the application can always render into an
+// image while one is being displayed and another one is queued.
+//
+// When the window is resized, the swapchain is recreated by passing the old
+// swapchain as oldSwapchain, which allows the implementation to reuse its
+// resources and to keep presenting the old images while the new ones are made.
+// The old swapchain is not destroyed right away, as the frames in flight may
+// still render into its images. Instead it's retired at the current point of
+// the graphics timeline and released once the device has reached that point.
+// ============================================================================
+
+static uint64_t gpu_progress(QueueRole role);
+static uint64_t timeline_last_value(QueueRole role);
+
+// ============================================================================
+// Get the name of the specified presentation mode.
+// @param presentMode The target presentation mode.
+// @returns The name of the presentation mode.
+static const char* present_mode_name(VkPresentModeKHR presentMode)
+{
+  switch (presentMode)
+  {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:
+      return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR:
+      return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR:
+      return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+      return "fifo-relaxed";
+    default:
+      return "unknown";
+  }
+}
+
+// ============================================================================
+// Select the surface format for the swapchain images.
+// @param formats The formats supported by the surface.
+// @returns The selected surface format.
+static VkSurfaceFormatKHR choose_surface_format(const std::vector<VkSurfaceFormatKHR>& formats)
+{
+  // a single undefined format means that the surface has no preference.
+  VkSurfaceFormatKHR preferred = { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+  if (formats.size() == 1 && formats[0].format == VK_FORMAT_UNDEFINED) {
+    return preferred;
+  }
+  for (const auto& format : formats) {
+    if (format.format == preferred.format && format.colorSpace == preferred.colorSpace) {
+      return format;
+    }
+  }
+  return formats[0];
+}
+
+// ============================================================================
+// Select the presentation mode with the lowest latency.
+// @param presentModes The presentation modes supported by the surface.
+// @returns The selected presentation mode.
+static VkPresentModeKHR choose_present_mode(const std::vector<VkPresentModeKHR>& presentModes)
+{
+  auto supports = [&](VkPresentModeKHR mode) {
+    return std::find(presentModes.begin(), presentModes.end(), mode) != presentModes.end();
+  };
+  if (sPresentModeOverride != VK_PRESENT_MODE_MAX_ENUM_KHR) {
+    if (supports(sPresentModeOverride)) {
+      return sPresentModeOverride;
+    }
+    LOG_WARNING("The requested presentation mode is not supported: %s\n", present_mode_name(sPresentModeOverride));
+  }
+  if (supports(VK_PRESENT_MODE_MAILBOX_KHR)) {
+    return VK_PRESENT_MODE_MAILBOX_KHR;
+  }
+  if (supports(VK_PRESENT_MODE_IMMEDIATE_KHR)) {
+    return VK_PRESENT_MODE_IMMEDIATE_KHR;
+  }
+  // FIFO is the only presentation mode that is required to be supported.
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+// ============================================================================
+// Select the amount of swapchain images for triple buffering.
+// @param capabilities The capabilities of the surface.
+// @returns The amount of swapchain images to request.
+static uint32_t choose_swapchain_image_count(const VkSurfaceCapabilitiesKHR& capabilities)
+{
+  uint32_t imageCount = std::max<uint32_t>(SWAPCHAIN_IMAGE_COUNT, capabilities.minImageCount);
+  if (capabilities.maxImageCount > 0) {
+    imageCount = std::min(imageCount, capabilities.maxImageCount);
+  }
+  return imageCount;
+}
+
+// ============================================================================
+// Select how the alpha of the swapchain images is composited with the window
+// system, preferring an opaque window as the alpha isn't meaningful here.
+// @param capabilities The capabilities of the surface.
+// @returns The selected composite alpha mode.
+static VkCompositeAlphaFlagBitsKHR choose_composite_alpha(const VkSurfaceCapabilitiesKHR& capabilities)
+{
+  const VkCompositeAlphaFlagBitsKHR preferred[] = {
+    VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+    VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR,
+    VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR,
+    VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR
+  };
+  for (auto compositeAlpha : preferred) {
+    if ((capabilities.supportedCompositeAlpha & compositeAlpha) != 0) {
+      return compositeAlpha;
+    }
+  }
+  // at least one of the composite alpha modes is required to be supported.
+  return VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+}
+
+// ============================================================================
+// Select the usage of the swapchain images. The frames are cleared with a
+// transfer, which requires the transfer destination usage from the surface.
+// @param capabilities The capabilities of the surface.
+// @returns The usage of the swapchain images.
+static VkImageUsageFlags choose_swapchain_image_usage(const VkSurfaceCapabilitiesKHR& capabilities)
+{
+  const VkImageUsageFlags required = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  if ((capabilities.supportedUsageFlags & required) != required) {
+    LOG_ERROR("The surface does not support the transfer destination usage for the swapchain images.\n");
+    exit_failure();
+  }
+  // the color attachment usage is always supported.
+  return required | (capabilities.supportedUsageFlags & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+}
+
+// ============================================================================
+// Destroy the image views and the semaphores of a retired swapchain.
+// @param retired The retired swapchain.
+static void destroy_retired_swapchain(RetiredSwapchain& retired)
+{
+  for (auto view : retired.imageViews) {
+    vkDestroyImageView(sLogicalDevice, view, host_allocator());
+  }
+  for (auto semaphore : retired.presentSemaphores) {
+    vkDestroySemaphore(sLogicalDevice, semaphore, host_allocator());
+  }
+  if (retired.swapchain != VK_NULL_HANDLE) {
+    vkDestroySwapchainKHR(sLogicalDevice, retired.swapchain, host_allocator());
+  }
+  retired = {};
+}
+
+// ============================================================================
+// Release the retired swapchains which the device has finished using.
+static void release_retired_swapchains()
+{
+  if (sRetiredSwapchains.empty()) {
+    return;
+  }
+  auto completedValue = gpu_progress(QUEUE_ROLE_GRAPHICS);
+  size_t released = 0;
+  while (released < sRetiredSwapchains.size() && sRetiredSwapchains[released].timelineValue <= completedValue) {
+    destroy_retired_swapchain(sRetiredSwapchains[released]);
+    released++;
+  }
+  sRetiredSwapchains.erase(sRetiredSwapchains.begin(), sRetiredSwapchains.begin() + released);
+}
+
+// ============================================================================
+// Create a new swapchain or recreate the current swapchain for the surface.
+static void create_swapchain()
+{
+  TraceZone zone("create_swapchain");
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+  assert(sSurface != VK_NULL_HANDLE);
+  auto startTime = std::chrono::steady_clock::now();
+
+  // get the current capabilities of the surface.
+  VkSurfaceCapabilitiesKHR capabilities;
+  auto result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(sPhysicalDevice, sSurface, &capabilities);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkGetPhysicalDeviceSurfaceCapabilitiesKHR failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+
+  // a zero sized surface (a minimized window) cannot have a swapchain.
+  VkExtent2D extent = capabilities.currentExtent;
+  if (extent.width == 0xFFFFFFFF) {
+    extent.width = std::max(capabilities.minImageExtent.width, std::min<uint32_t>(capabilities.maxImageExtent.width, OFFSCREEN_IMAGE_WIDTH));
+    extent.height = std::max(capabilities.minImageExtent.height, std::min<uint32_t>(capabilities.maxImageExtent.height, OFFSCREEN_IMAGE_HEIGHT));
+  }
+  if (extent.width == 0 || extent.height == 0) {
+    sWindowMinimized = true;
+    return;
+  }
+
+  // the supported formats and presentation modes are only queried once.
+  if (sSwapchain == VK_NULL_HANDLE) {
+    uint32_t formatCount = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(sPhysicalDevice, sSurface, &formatCount, NULL);
+    std::vector<VkSurfaceFormatKHR> formats(formatCount);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(sPhysicalDevice, sSurface, &formatCount, formats.data());
+    if (formats.empty()) {
+      LOG_ERROR("vkGetPhysicalDeviceSurfaceFormatsKHR failed: the surface has no formats.\n");
+      exit_failure();
+    }
+    sSwapchainFormat = choose_surface_format(formats);
+
+    uint32_t presentModeCount = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(sPhysicalDevice, sSurface, &presentModeCount, NULL);
+    std::vector<VkPresentModeKHR> presentModes(presentModeCount);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(sPhysicalDevice, sSurface, &presentModeCount, presentModes.data());
+    sSwapchainPresentMode = choose_present_mode(presentModes);
+  }
+
+  // create a descriptor for the swapchain, which replaces the old swapchain.
+  uint32_t queueFamilyIndices[] = { sQueues[QUEUE_ROLE_GRAPHICS].familyIndex, sQueues[QUEUE_ROLE_PRESENT].familyIndex };
+  VkSwapchainCreateInfoKHR createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+  createInfo.pNext = NULL;
+  createInfo.flags = 0;
+  createInfo.surface = sSurface;
+  createInfo.minImageCount = choose_swapchain_image_count(capabilities);
+  createInfo.imageFormat = sSwapchainFormat.format;
+  createInfo.imageColorSpace = sSwapchainFormat.colorSpace;
+  createInfo.imageExtent = extent;
+  createInfo.imageArrayLayers = 1;
+  createInfo.imageUsage = choose_swapchain_image_usage(capabilities);
+  if (queueFamilyIndices[0] != queueFamilyIndices[1]) {
+    createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+    createInfo.queueFamilyIndexCount = 2;
+    createInfo.pQueueFamilyIndices = queueFamilyIndices;
+  } else {
+    createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    createInfo.queueFamilyIndexCount = 0;
+    createInfo.pQueueFamilyIndices = NULL;
+  }
+  createInfo.preTransform = capabilities.currentTransform;
+  createInfo.compositeAlpha = choose_composite_alpha(capabilities);
+  createInfo.presentMode = sSwapchainPresentMode;
+  createInfo.clipped = VK_TRUE;
+  createInfo.oldSwapchain = sSwapchain;
+
+  VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+  result = vkCreateSwapchainKHR(sLogicalDevice, &createInfo, host_allocator(), &swapchain);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkCreateSwapchainKHR failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+
+  // the old swapchain is retired, as its images may still be in use.
+  if (sSwapchain != VK_NULL_HANDLE) {
+    RetiredSwapchain retired;
+    retired.swapchain = sSwapchain;
+    retired.imageViews.swap(sSwapchainImageViews);
+    retired.presentSemaphores.swap(sPresentSemaphores);
+    retired.timelineValue = timeline_last_value(QUEUE_ROLE_GRAPHICS);
+    sRetiredSwapchains.push_back(std::move(retired));
+    sSwapchainImages.clear();
+  }
+  sSwapchain = swapchain;
+  sSwapchainExtent = extent;
+  sSwapchainOutOfDate = false;
+  sWindowMinimized = false;
+
+  // get the swapchain images and create views for them.
+  uint32_t imageCount = 0;
+  vkGetSwapchainImagesKHR(sLogicalDevice, sSwapchain, &imageCount, NULL);
+  sSwapchainImages.resize(imageCount);
+  vkGetSwapchainImagesKHR(sLogicalDevice, sSwapchain, &imageCount, sSwapchainImages.data());
+  for (auto image : sSwapchainImages) {
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.pNext = NULL;
+    viewInfo.flags = 0;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = sSwapchainFormat.format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    VkImageView view = VK_NULL_HANDLE;
+    result = vkCreateImageView(sLogicalDevice, &viewInfo, host_allocator(), &view);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkCreateImageView failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+    sSwapchainImageViews.push_back(view);
+
+    // the presentation must wait until the rendering into the image is done.
+    // these are per image instead of per frame, as an image is only acquired
+    // again after its previous presentation has consumed the semaphore.
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = NULL;
+    semaphoreInfo.flags = 0;
+
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    result = vkCreateSemaphore(sLogicalDevice, &semaphoreInfo, host_allocator(), &semaphore);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkCreateSemaphore failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+    sPresentSemaphores.push_back(semaphore);
+  }
+
+  LOG_INFO("Created a swapchain with [%d] images (%dx%d, %s) in %.3f ms.\n",
+    imageCount,
+    extent.width,
+    extent.height,
+    present_mode_name(sSwapchainPresentMode),
+    milliseconds_since(startTime));
+}
+
+// ============================================================================
+
+static void destroy_swapchain()
+{
+  // the device is idle, so the retired swapchains can be released as well.
+  for (auto& retired : sRetiredSwapchains) {
+    destroy_retired_swapchain(retired);
+  }
+  sRetiredSwapchains.clear();
+
+  RetiredSwapchain current;
+  current.swapchain = sSwapchain;
+  current.imageViews.swap(sSwapchainImageViews);
+  current.presentSemaphores.swap(sPresentSemaphores);
+  destroy_retired_swapchain(current);
+  sSwapchain = VK_NULL_HANDLE;
+  sSwapchainImages.clear();
+}
+
+// ============================================================================
+// GPU PROFILER
+// ============================================================================
+// The GPU profiler measures the time spent by the device in named zones of the
+// command buffers by writing timestamp queries at the beginning and at the end
+// of each zone. Zones may be nested, e.g. a frame zone may contain pass zones.
+//
+// Each frame in flight owns a query pool, which forms a ring of query pools.
+// The results of a frame are read back only after the timeline point of the
+// frame has been waited, i.e. N frames later, so the readback never stalls the device.
+//
+// The timestamps are in device ticks, which are converted into nanoseconds by
+// the timestampPeriod limit of the physical device. Only the timestampValidBits
+// lowest bits of the timestamps are valid, so the differences are masked.
+// ============================================================================
+
+// The maximum amount of zones recorded in a single frame.
+#define GPU_PROFILER_MAX_ZONES 64
+// The maximum nesting depth of the zones.
+#define GPU_PROFILER_MAX_DEPTH 8
+// An invalid zone index for the zones that did not fit into the query pool.
+#define GPU_ZONE_NONE 0xffffffffu
+
+// A zone recorded into a command buffer with a pair of timestamp queries.
+struct GpuZoneRecord
+{
+  const char* name;
+  uint32_t    depth;
+  uint32_t    beginQuery;
+  uint32_t    endQuery;
+};
+
+// The timestamp queries and the zones of a single frame in flight.
+struct GpuProfilerFrame
+{
+  VkQueryPool queryPool;
+  uint32_t    queryCount;
+  bool        pending;
+  int64_t     recordTime;
+  std::vector<GpuZoneRecord> zones;
+};
+
+// The accumulated timings of the zones with the same name and depth.
+struct GpuZoneStatistics
+{
+  const char* name;
+  uint32_t    depth;
+  uint64_t    count;
+  double      total;
+  double      min;
+  double      max;
+};
+
+// Whether to measure the GPU zones with timestamp queries.
+static bool sUseGpuProfiler = true;
+// The mask of the valid bits in the timestamps.
+static uint64_t sGpuTimestampMask = 0;
+// The query pools and the zones of each frame in flight.
+static GpuProfilerFrame sGpuProfilerFrames[MAX_FRAMES_IN_FLIGHT] = {};
+// The frame being recorded or NULL if the profiler is not recording.
+static GpuProfilerFrame* sGpuProfilerFrame = NULL;
+// The zones that have been begun but not yet ended.
+static uint32_t sGpuZoneStack[GPU_PROFILER_MAX_DEPTH];
+// The amount of zones that have been begun but not yet ended.
+static uint32_t sGpuZoneDepth = 0;
+// The accumulated timings of the zones.
+static std::vector<GpuZoneStatistics> sGpuZoneStatistics;
+// The trace buffer of the GPU zones.
+static TraceBuffer* sGpuTraceBuffer = nullptr;
+// Whether the device timestamps have been aligned with the trace clock.
+static bool sGpuClockCalibrated = false;
+// A device timestamp that was sampled at the same moment as sGpuCalibrationTime.
+static uint64_t sGpuCalibrationTicks = 0;
+// A trace clock time that was sampled at the same moment as sGpuCalibrationTicks.
+static int64_t sGpuCalibrationTime = 0;
+
+// ============================================================================
+// Align the device timestamps with the trace clock by sampling both of the
+// clocks at the same time with VK_EXT_calibrated_timestamps. Without it, the
+// clocks are later aligned approximately by the first recorded frame.
+static void calibrate_gpu_clock()
+{
+  if (!sCalibratedTimestamps) {
+    LOG_WARNING("VK_EXT_calibrated_timestamps is not available, GPU zones are aligned approximately.\n");
+    return;
+  }
+
+  if (!vkGetPhysicalDeviceCalibrateableTimeDomainsEXT || !vkGetCalibratedTimestampsEXT) {
+    LOG_WARNING("Unable to find the calibrated timestamp functions.\n");
+    return;
+  }
+
+  // the host time domain must be the clock behind std::chrono::steady_clock.
+#ifdef _WIN32
+  const VkTimeDomainEXT hostTimeDomain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+#else
+  const VkTimeDomainEXT hostTimeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+#endif
+  uint32_t timeDomainCount = 0;
+  vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(sPhysicalDevice, &timeDomainCount, NULL);
+  std::vector<VkTimeDomainEXT> timeDomains(timeDomainCount);
+  vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(sPhysicalDevice, &timeDomainCount, timeDomains.data());
+  if (std::find(timeDomains.begin(), timeDomains.end(), VK_TIME_DOMAIN_DEVICE_EXT) == timeDomains.end() ||
+      std::find(timeDomains.begin(), timeDomains.end(), hostTimeDomain) == timeDomains.end()) {
+    LOG_WARNING("The device cannot calibrate its timestamps with the host clock.\n");
+    return;
+  }
+
+  VkCalibratedTimestampInfoEXT infos[2] = {};
+  infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+  infos[0].pNext = NULL;
+  infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+  infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+  infos[1].pNext = NULL;
+  infos[1].timeDomain = hostTimeDomain;
+  uint64_t timestamps[2] = {};
+  uint64_t maxDeviation = 0;
+  auto result = vkGetCalibratedTimestampsEXT(sLogicalDevice, 2, infos, timestamps, &maxDeviation);
+  if (result != VK_SUCCESS) {
+    LOG_WARNING("vkGetCalibratedTimestampsEXT failed: %s\n", vulkan_result_description(result).c_str());
+    return;
+  }
+
+  // convert the host timestamp into nanoseconds since the steady clock epoch.
+#ifdef _WIN32
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  auto ticksPerSecond = static_cast<uint64_t>(frequency.QuadPart);
+  auto hostTime = static_cast<int64_t>((timestamps[1] / ticksPerSecond) * 1000000000ull + (timestamps[1] % ticksPerSecond) * 1000000000ull / ticksPerSecond);
+#else
+  auto hostTime = static_cast<int64_t>(timestamps[1]);
+#endif
+  auto startupTime = std::chrono::duration_cast<std::chrono::nanoseconds>(sStartupTime.time_since_epoch()).count();
+  sGpuCalibrationTicks = timestamps[0];
+  sGpuCalibrationTime = hostTime - startupTime;
+  sGpuClockCalibrated = true;
+  LOG_INFO("Calibrated the GPU clock with the host clock (max deviation: %llu ns).\n",
+    static_cast<unsigned long long>(maxDeviation));
+}
+
+// ============================================================================
+// Convert a device timestamp into the trace clock.
+// @param ticks The device timestamp.
+// @returns The time in nanoseconds since the application startup.
+static int64_t gpu_trace_time(uint64_t ticks)
+{
+  auto delta = static_cast<int64_t>(ticks - sGpuCalibrationTicks);
+  return sGpuCalibrationTime + static_cast<int64_t>(delta * static_cast<double>(sPhysicalDeviceProperties.limits.timestampPeriod));
+}
+
+// ============================================================================
+
+static void create_gpu_profiler()
+{
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+  if (!sUseGpuProfiler) {
+    return;
+  }
+
+  // timestamps are only supported by queues with valid timestamp bits.
+  const auto& queueFamilies = sPhysicalDeviceCapabilities.queueFamilies;
+  auto validBits = queueFamilies[sQueues[QUEUE_ROLE_GRAPHICS].familyIndex].timestampValidBits;
+  if (validBits == 0) {
+    LOG_WARNING("The graphics queue does not support timestamps, GPU profiler is disabled.\n");
+    sUseGpuProfiler = false;
+    return;
+  }
+  sGpuTimestampMask = validBits >= 64 ? UINT64_MAX : ((1ull << validBits) - 1);
+
+  for (uint32_t i = 0; i < sFramesInFlight; i++) {
+    VkQueryPoolCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    createInfo.pNext = NULL;
+    createInfo.flags = 0;
+    createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    createInfo.queryCount = 2 * GPU_PROFILER_MAX_ZONES;
+    createInfo.pipelineStatistics = 0;
+
+    auto& frame = sGpuProfilerFrames[i];
+    auto result = vkCreateQueryPool(sLogicalDevice, &createInfo, host_allocator(), &frame.queryPool);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkCreateQueryPool failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+    frame.zones.reserve(GPU_PROFILER_MAX_ZONES);
+  }
+  if (sUseTrace) {
+    if (sGpuTraceBuffer == nullptr) {
+      sGpuTraceBuffer = trace_create_buffer("GPU (graphics queue)");
+    }
+    calibrate_gpu_clock();
+  }
+  LOG_INFO("Created a GPU profiler with [%d] query pools (period: %.3f ns, valid bits: %d).\n",
+    sFramesInFlight,
+    sPhysicalDeviceProperties.limits.timestampPeriod,
+    validBits);
+}
+
+// ============================================================================
+
+static void destroy_gpu_profiler()
+{
+  for (auto& frame : sGpuProfilerFrames) {
+    if (frame.queryPool != VK_NULL_HANDLE) {
+      vkDestroyQueryPool(sLogicalDevice, frame.queryPool, host_allocator());
+    }
+    frame.queryPool = VK_NULL_HANDLE;
+    frame.zones.clear();
+  }
+  sGpuProfilerFrame = NULL;
+}
+
+// ============================================================================
+// Begin recording the zones of a frame into the specified command buffer.
+// @param commandBuffer The command buffer of the frame.
+// @param frameIndex The index of the frame in flight.
+static void gpu_profiler_begin_frame(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+  if (!sUseGpuProfiler) {
+    return;
+  }
+  auto& frame = sGpuProfilerFrames[frameIndex];
+  vkCmdResetQueryPool(commandBuffer, frame.queryPool, 0, 2 * GPU_PROFILER_MAX_ZONES);
+  frame.queryCount = 0;
+  frame.pending = true;
+  frame.recordTime = sUseTrace ? trace_now() : 0;
+  frame.zones.clear();
+  sGpuProfilerFrame = &frame;
+  sGpuZoneDepth = 0;
+}
+
+// ============================================================================
+// Begin a named zone by writing a timestamp at the top of the pipe.
+// @param commandBuffer The command buffer being recorded.
+// @param name The name of the zone (must be a string literal).
+static void gpu_zone_begin(VkCommandBuffer commandBuffer, const char* name)
+{
+  auto frame = sGpuProfilerFrame;
+  if (frame == NULL) {
+    return;
+  }
+  assert(sGpuZoneDepth < GPU_PROFILER_MAX_DEPTH);
+
+  // zones that do not fit into the query pool are silently skipped.
+  auto index = GPU_ZONE_NONE;
+  if (frame->queryCount + 2 <= 2 * GPU_PROFILER_MAX_ZONES) {
+    index = static_cast<uint32_t>(frame->zones.size());
+    GpuZoneRecord zone = { name, sGpuZoneDepth, frame->queryCount, frame->queryCount + 1 };
+    frame->zones.push_back(zone);
+    frame->queryCount += 2;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->queryPool, zone.beginQuery);
+  }
+  sGpuZoneStack[sGpuZoneDepth++] = index;
+}
+
+// ============================================================================
+// End the innermost zone by writing a timestamp at the bottom of the pipe.
+// @param commandBuffer The command buffer being recorded.
+static void gpu_zone_end(VkCommandBuffer commandBuffer)
+{
+  auto frame = sGpuProfilerFrame;
+  if (frame == NULL) {
+    return;
+  }
+  assert(sGpuZoneDepth > 0);
+  auto index = sGpuZoneStack[--sGpuZoneDepth];
+  if (index != GPU_ZONE_NONE) {
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->queryPool, frame->zones[index].endQuery);
+  }
+}
+
+// ============================================================================
+// A scoped GPU zone that is ended when the scope is exited.
+class GpuProfilerZone
+{
+public:
+  GpuProfilerZone(VkCommandBuffer commandBuffer, const char* name) : mCommandBuffer(commandBuffer) { gpu_zone_begin(commandBuffer, name); }
+  ~GpuProfilerZone() { gpu_zone_end(mCommandBuffer); }
+private:
+  VkCommandBuffer mCommandBuffer;
+};
+
+// ============================================================================
+// Read back the zones of a frame whose fence has been signaled.
+// @param frameIndex The index of the frame in flight.
+static void gpu_profiler_collect(uint32_t frameIndex)
+{
+  if (!sUseGpuProfiler) {
+    return;
+  }
+  auto& frame = sGpuProfilerFrames[frameIndex];
+  if (!frame.pending || frame.queryCount == 0) {
+    return;
+  }
+  frame.pending = false;
+
+  // the frame has been waited, so the results are available without waiting.
+  uint64_t timestamps[2 * GPU_PROFILER_MAX_ZONES];
+  auto result = vkGetQueryPoolResults(sLogicalDevice,
+    frame.queryPool,
+    0,
+    frame.queryCount,
+    sizeof(timestamps),
+    timestamps,
+    sizeof(uint64_t),
+    VK_QUERY_RESULT_64_BIT);
+  if (result == VK_NOT_READY) {
+    return;
+  } else if (result != VK_SUCCESS) {
+    LOG_ERROR("vkGetQueryPoolResults failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+
+  // without calibration, the first zone is assumed to begin at the recording.
+  auto trace = sUseTrace && sGpuTraceBuffer != nullptr;
+  if (trace && !sGpuClockCalibrated) {
+    sGpuCalibrationTicks = timestamps[frame.zones[0].beginQuery];
+    sGpuCalibrationTime = frame.recordTime;
+    sGpuClockCalibrated = true;
+  }
+
+  // accumulate the timings of the zones in milliseconds.
+  auto period = static_cast<double>(sPhysicalDeviceProperties.limits.timestampPeriod);
+  for (const auto& zone : frame.zones) {
+    auto ticks = (timestamps[zone.endQuery] - timestamps[zone.beginQuery]) & sGpuTimestampMask;
+    auto milliseconds = ticks * period / 1000000.0;
+    if (trace) {
+      auto begin = gpu_trace_time(timestamps[zone.beginQuery]);
+      trace_event(sGpuTraceBuffer, zone.name, begin, begin + static_cast<int64_t>(ticks * period));
+    }
+    auto it = std::find_if(sGpuZoneStatistics.begin(), sGpuZoneStatistics.end(), [&](const GpuZoneStatistics& statistics) {
+      return statistics.name == zone.name && statistics.depth == zone.depth;
+    });
+    if (it == sGpuZoneStatistics.end()) {
+      GpuZoneStatistics statistics = { zone.name, zone.depth, 0, 0.0, milliseconds, milliseconds };
+      it = sGpuZoneStatistics.insert(sGpuZoneStatistics.end(), statistics);
+    }
+    it->count++;
+    it->total += milliseconds;
+    it->min = std::min(it->min, milliseconds);
+    it->max = std::max(it->max, milliseconds);
+  }
+}
+
+// ============================================================================
+
+static void print_gpu_profiler_statistics()
+{
+  if (sGpuZoneStatistics.empty()) {
+    return;
+  }
+  LOG_INFO("GPU zones (ms):\n");
+  LOG_INFO("\t%-32s %8s %10s %10s %10s\n", "zone", "count", "avg", "min", "max");
+  for (const auto& statistics : sGpuZoneStatistics) {
+    auto name = std::string(2 * statistics.depth, ' ') + statistics.name;
+    LOG_INFO("\t%-32s %8llu %10.3f %10.3f %10.3f\n",
+      name.c_str(),
+      static_cast<unsigned long long>(statistics.count),
+      statistics.total / statistics.count,
+      statistics.min,
+      statistics.max);
+  }
+}
+
+// ============================================================================
+// JOBS
+// ============================================================================
+// A work-stealing job system that is shared by the initialization tasks and the
+// parallel recording. There's one job worker per core and the main thread is
+// the worker 0, so the workers never oversubscribe the cores. Each worker owns
+// a Chase-Lev deque, where it pushes and pops its jobs at the bottom while the
+// idle workers steal the oldest jobs from the top:
+//
+//   worker 0: [top] job job job [bottom] <-- push/pop by worker 0
+//                ^
+//                '-- steal by the other workers
+//
+// A job can signal a counter, which is incremented when the job is submitted
+// and decremented when the job is done. Waiting for a counter executes other
+// jobs in the meantime. A job may also depend on counters, in which case it's
+// only pushed to a deque once all of the counters have reached zero.
+//
+// The idle workers spin for a while before they sleep on a condition, which is
+// only signaled when there are sleeping workers.
+// ============================================================================
+
+// The maximum amount of job workers including the main thread.
+#define MAX_JOB_WORKERS 32
+// The capacity of the job deque of a worker (must be a power of two).
+#define JOB_DEQUE_CAPACITY 4096
+// The amount of failed attempts to find a job before a worker sleeps.
+#define JOB_SPIN_COUNT 64
+
+struct Job;
+
+// A counter of unfinished jobs and the jobs waiting for it to reach zero.
+struct JobCounter
+{
+  std::atomic<uint32_t> pending;
+  std::mutex            mutex;
+  std::vector<Job*>     waiters;
+
+  JobCounter() : pending(0) {}
+};
+
+// A job with the counter it signals and the amount of unfinished dependencies.
+struct Job
+{
+  std::function<void()> function;
+  JobCounter*           counter;
+  std::atomic<uint32_t> dependencies;
+};
+
+// A Chase-Lev deque of jobs, which is owned by a single worker.
+struct JobDeque
+{
+  std::atomic<int64_t> top;
+  std::atomic<int64_t> bottom;
+  std::atomic<Job*>    jobs[JOB_DEQUE_CAPACITY];
+};
+
+// The user requested amount of job workers or zero to use all cores.
+static uint32_t sRequestedJobWorkerCount = 0;
+// The amount of job workers including the main thread.
+static uint32_t sJobWorkerCount = 0;
+// The job worker threads excluding the main thread.
+static std::vector<std::thread> sJobWorkers;
+// The job deques indexed by the job worker.
+static std::unique_ptr<JobDeque[]> sJobDeques;
+// The trace track names of the job workers.
+static char sJobWorkerNames[MAX_JOB_WORKERS][24] = {};
+// The jobs submitted by the threads that aren't job workers.
+static std::vector<Job*> sInjectedJobs;
+// The amount of the jobs submitted by the threads that aren't job workers.
+static std::atomic<uint32_t> sInjectedJobCount(0);
+// The mutex guarding the injected jobs.
+static std::mutex sInjectedJobMutex;
+// The mutex used with the condition of the sleeping workers.
+static std::mutex sJobMutex;
+// The condition used to wake up the sleeping workers.
+static std::condition_variable sJobCondition;
+// The amount of sleeping job workers.
+static std::atomic<uint32_t> sJobSleepers(0);
+// Whether the job workers should exit.
+static std::atomic<bool> sJobStop(false);
+// The index of the job worker of the current thread or -1 if none.
+static thread_local int sJobWorkerIndex = -1;
+
+// ============================================================================
+// Push a job to the bottom of a deque. Only called by the owner of the deque.
+// @param deque The job deque.
+// @param job The job to push.
+// @returns Whether the job was pushed, or false when the deque is full.
+static bool job_deque_push(JobDeque& deque, Job* job)
+{
+  auto bottom = deque.bottom.load(std::memory_order_relaxed);
+  auto top = deque.top.load(std::memory_order_acquire);
+  if (bottom - top >= JOB_DEQUE_CAPACITY) {
+    return false;
+  }
+  deque.jobs[bottom & (JOB_DEQUE_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+  deque.bottom.store(bottom + 1, std::memory_order_seq_cst);
+  return true;
+}
+
+// ============================================================================
+// Pop the newest job from the bottom of a deque. Only called by the owner of
+// the deque.
+// @param deque The job deque.
+// @returns The job or nullptr if the deque is empty.
+static Job* job_deque_pop(JobDeque& deque)
+{
+  auto bottom = deque.bottom.load(std::memory_order_relaxed) - 1;
+  deque.bottom.store(bottom, std::memory_order_seq_cst);
+  auto top = deque.top.load(std::memory_order_seq_cst);
+  if (top > bottom) {
+    deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  auto job = deque.jobs[bottom & (JOB_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+  if (top == bottom) {
+    // the last job may be stolen at the same time.
+    if (!deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      job = nullptr;
+    }
+    deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+// ============================================================================
+// Steal the oldest job from the top of a deque.
+// @param deque The job deque.
+// @returns The job or nullptr if the deque is empty or another thread won.
+static Job* job_deque_steal(JobDeque& deque)
+{
+  auto top = deque.top.load(std::memory_order_seq_cst);
+  auto bottom = deque.bottom.load(std::memory_order_seq_cst);
+  if (top >= bottom) {
+    return nullptr;
+  }
+  auto job = deque.jobs[top & (JOB_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+  if (!deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return job;
+}
+
+// ============================================================================
+// Get the index of the job worker of the current thread.
+// @returns The index of the job worker or -1 if the thread isn't a job worker.
+static int job_worker_index()
+{
+  return sJobWorkerIndex;
+}
+
+// ============================================================================
+// Get the amount of job workers including the main thread.
+// @returns The amount of job workers.
+static uint32_t job_worker_count()
+{
+  return sJobWorkerCount;
+}
+
+// ============================================================================
+// Check whether any worker has a job that could be executed.
+// @returns Whether there's a job in any of the deques.
+static bool jobs_available()
+{
+  if (sInjectedJobCount.load() > 0) {
+    return true;
+  }
+  for (uint32_t i = 0; i < sJobWorkerCount; i++) {
+    if (sJobDeques[i].bottom.load() > sJobDeques[i].top.load()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// ============================================================================
+// Make a job available to the workers and wake up a sleeping worker.
+// @param job The job whose dependencies are done.
+static void push_job(Job* job)
+{
+  auto worker = sJobWorkerIndex;
+  if (worker < 0 || !job_deque_push(sJobDeques[worker], job)) {
+    std::lock_guard<std::mutex> lock(sInjectedJobMutex);
+    sInjectedJobs.push_back(job);
+    sInjectedJobCount.fetch_add(1);
+  }
+  if (sJobSleepers.load() > 0) {
+    std::lock_guard<std::mutex> lock(sJobMutex);
+    sJobCondition.notify_one();
+  }
+}
+
+// ============================================================================
+// Find a job for the current thread from its own deque, from the injected jobs
+// or from the deques of the other workers.
+// @returns The job or nullptr if none was found.
+static Job* find_job()
+{
+  auto worker = sJobWorkerIndex;
+  if (worker >= 0) {
+    auto job = job_deque_pop(sJobDeques[worker]);
+    if (job != nullptr) {
+      return job;
+    }
+  }
+  if (sInjectedJobCount.load() > 0) {
+    std::lock_guard<std::mutex> lock(sInjectedJobMutex);
+    if (!sInjectedJobs.empty()) {
+      auto job = sInjectedJobs.back();
+      sInjectedJobs.pop_back();
+      sInjectedJobCount.fetch_sub(1);
+      return job;
+    }
+  }
+  // start from the next worker so that the victims are spread evenly.
+  auto start = static_cast<uint32_t>(worker + 1);
+  for (uint32_t i = 0; i < sJobWorkerCount; i++) {
+    auto victim = (start + i) % sJobWorkerCount;
+    if (static_cast<int>(victim) == worker) {
+      continue;
+    }
+    auto job = job_deque_steal(sJobDeques[victim]);
+    if (job != nullptr) {
+      return job;
+    }
+  }
+  return nullptr;
+}
+
+// ============================================================================
+// Add unfinished jobs to a counter.
+// @param counter The job counter.
+// @param count The amount of jobs to add.
+static void job_counter_add(JobCounter& counter, uint32_t count)
+{
+  std::lock_guard<std::mutex> lock(counter.mutex);
+  counter.pending.fetch_add(count);
+}
+
+// ============================================================================
+// Mark a job of a counter as done and release the jobs waiting for the counter
+// when it reaches zero.
+// @param counter The job counter.
+static void job_counter_done(JobCounter& counter)
+{
+  std::vector<Job*> waiters;
+  {
+    std::lock_guard<std::mutex> lock(counter.mutex);
+    assert(counter.pending.load() > 0);
+    if (counter.pending.fetch_sub(1) == 1) {
+      waiters.swap(counter.waiters);
+    }
+  }
+  for (auto waiter : waiters) {
+    if (waiter->dependencies.fetch_sub(1) == 1) {
+      push_job(waiter);
+    }
+  }
+}
+
+// ============================================================================
+// Execute a job and signal its counter.
+// @param job The job to execute, which is deleted afterwards.
+static void execute_job(Job* job)
+{
+  job->function();
+  auto counter = job->counter;
+  delete job;
+  if (counter != nullptr) {
+    job_counter_done(*counter);
+  }
+}
+
+// ============================================================================
+// Submit a job that runs once all of its dependencies have reached zero.
+// @param function The function of the job.
+// @param counter The counter signaled by the job or nullptr if none.
+// @param dependencies The counters that must reach zero before the job runs.
+// @param dependencyCount The amount of dependencies.
+static void run_job(std::function<void()> function, JobCounter* counter, JobCounter* const* dependencies = nullptr, uint32_t dependencyCount = 0)
+{
+  auto job = new Job();
+  job->function = std::move(function);
+  job->counter = counter;
+  if (counter != nullptr) {
+    job_counter_add(*counter, 1);
+  }
+
+  // the extra dependency keeps the job from being released while registering.
+  job->dependencies.store(dependencyCount + 1);
+  for (uint32_t i = 0; i < dependencyCount; i++) {
+    auto dependency = dependencies[i];
+    std::lock_guard<std::mutex> lock(dependency->mutex);
+    if (dependency->pending.load() > 0) {
+      dependency->waiters.push_back(job);
+    } else {
+      job->dependencies.fetch_sub(1);
+    }
+  }
+  if (job->dependencies.fetch_sub(1) == 1) {
+    push_job(job);
+  }
+}
+
+// ============================================================================
+// Wait until a counter reaches zero while executing the other jobs.
+// @param counter The job counter.
+static void wait_for_counter(JobCounter& counter)
+{
+  TraceZone zone("wait_for_counter");
+  while (counter.pending.load() > 0) {
+    auto job = find_job();
+    if (job != nullptr) {
+      execute_job(job);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  // the last job may still hold the mutex of the counter.
+  std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+// ============================================================================
+// Split a range into batches that are executed in parallel by the job workers.
+// The first batch is executed by the calling thread, which then waits for the
+// other batches.
+// @param count The amount of items in the range.
+// @param batchCount The amount of batches to split the range into.
+// @param function The function called with the batch index and its range.
+static void parallel_for(uint32_t count, uint32_t batchCount, const std::function<void(uint32_t, uint32_t, uint32_t)>& function)
+{
+  batchCount = std::max(1u, std::min(batchCount, count));
+  if (count == 0) {
+    return;
+  }
+  JobCounter counter;
+  for (uint32_t batch = 1; batch < batchCount; batch++) {
+    auto begin = static_cast<uint32_t>(static_cast<uint64_t>(batch) * count / batchCount);
+    auto end = static_cast<uint32_t>(static_cast<uint64_t>(batch + 1) * count / batchCount);
+    run_job([&function, batch, begin, end] { function(batch, begin, end); }, &counter);
+  }
+  function(0, 0, static_cast<uint32_t>(static_cast<uint64_t>(count) / batchCount));
+  wait_for_counter(counter);
+}
+
+// ============================================================================
+// The main function of a job worker thread, which executes the jobs until the
+// job system is stopped.
+// @param worker The index of the job worker.
+static void job_worker(int worker)
+{
+  sJobWorkerIndex = worker;
+  trace_thread_name(sJobWorkerNames[worker]);
+  auto failures = 0;
+  while (!sJobStop.load()) {
+    auto job = find_job();
+    if (job != nullptr) {
+      execute_job(job);
+      failures = 0;
+    } else if (++failures < JOB_SPIN_COUNT) {
+      std::this_thread::yield();
+    } else {
+      // recheck after becoming a sleeper, so that a new job can't be missed.
+      std::unique_lock<std::mutex> lock(sJobMutex);
+      sJobSleepers.fetch_add(1);
+      if (!sJobStop.load() && !jobs_available()) {
+        sJobCondition.wait(lock);
+      }
+      sJobSleepers.fetch_sub(1);
+      failures = 0;
+    }
+  }
+}
+
+// ============================================================================
+// Start the job workers and make the calling thread the job worker 0.
+static void start_job_system()
+{
+  assert(sJobWorkers.empty());
+  auto cores = std::max(1u, std::thread::hardware_concurrency());
+  sJobWorkerCount = std::min<uint32_t>(sRequestedJobWorkerCount > 0 ? sRequestedJobWorkerCount : cores, MAX_JOB_WORKERS);
+  sJobDeques.reset(new JobDeque[sJobWorkerCount]);
+  for (uint32_t i = 0; i < sJobWorkerCount; i++) {
+    sJobDeques[i].top.store(0);
+    sJobDeques[i].bottom.store(0);
+  }
+  sJobStop.store(false);
+  sJobWorkerIndex = 0;
+  for (uint32_t worker = 1; worker < sJobWorkerCount; worker++) {
+    snprintf(sJobWorkerNames[worker], sizeof(sJobWorkerNames[worker]), "job worker %u", worker);
+    sJobWorkers.emplace_back(job_worker, static_cast<int>(worker));
+  }
+  LOG_INFO("Started a job system with [%d] worker(s) on [%d] core(s).\n", sJobWorkerCount, cores);
+}
+
+// ============================================================================
+// Stop and join the job workers. The jobs must have been waited before this.
+static void stop_job_system()
+{
+  {
+    std::lock_guard<std::mutex> lock(sJobMutex);
+    sJobStop.store(true);
+    sJobCondition.notify_all();
+  }
+  for (auto& worker : sJobWorkers) {
+    worker.join();
+  }
+  sJobWorkers.clear();
+}
+
+// ============================================================================
+// COMMAND POOLS
+// ============================================================================
+// The command buffers are allocated from command pools, which are owned by a
+// single job worker, a single frame in flight and a single queue family:
+//
+//   pool[worker][frame][family]
+//
+// As each worker records only into its own pools, the recording needs no locks
+// even though command pools must be externally synchronized. The workers are
+// identified by their job worker index (see JOBS), where the main thread is 0.
+//
+// The command buffers are never reset or freed one by one. Instead all pools of
+// a frame are reset in bulk once the timeline point of the frame has been
+// waited, after which the command buffers are handed out again in the same
+// order. Therefore every command buffer allocated for a frame must have
+// completed execution by the time the frame reaches its point on the timeline.
+//
+// The pools are created lazily by the worker that first needs them, so only the
+// workers and queue families that are actually used own command pools.
+// ============================================================================
+
+// The primary and secondary command buffers of a command pool.
+struct CommandPoolLevel
+{
+  std::vector<VkCommandBuffer> buffers;
+  uint32_t                     used;
+};
+
+// A command pool of a single job worker, frame in flight and queue family.
+struct CommandPool
+{
+  VkCommandPool    pool;
+  CommandPoolLevel levels[2];
+};
+
+// The command pools indexed by the job worker, the frame and the family slot.
+static std::vector<CommandPool> sCommandPools;
+// The distinct queue families used by the queue roles.
+static std::vector<uint32_t> sCommandPoolFamilies;
+// The family slot of each queue role.
+static uint32_t sCommandPoolFamilySlots[QUEUE_ROLE_COUNT] = {};
+
+// ============================================================================
+// Prepare the (still empty) command pool slots for the queue families used by
+// the queue roles. Must be called after the logical device has been created.
+static void init_command_pools()
+{
+  sCommandPoolFamilies.clear();
+  for (int role = 0; role < QUEUE_ROLE_COUNT; role++) {
+    auto family = sQueues[role].familyIndex;
+    auto it = std::find(sCommandPoolFamilies.begin(), sCommandPoolFamilies.end(), family);
+    sCommandPoolFamilySlots[role] = static_cast<uint32_t>(it - sCommandPoolFamilies.begin());
+    if (it == sCommandPoolFamilies.end()) {
+      sCommandPoolFamilies.push_back(family);
+    }
+  }
+  sCommandPools.assign(MAX_JOB_WORKERS * MAX_FRAMES_IN_FLIGHT * sCommandPoolFamilies.size(), CommandPool());
+}
+
+// ============================================================================
+// Get the command pool of the job worker for the frame and the queue role.
+// @param thread The index of the job worker.
+// @param frameIndex The index of the frame in flight.
+// @param role The queue role whose queue family the pool belongs to.
+static CommandPool& get_command_pool(uint32_t thread, uint32_t frameIndex, QueueRole role)
+{
+  assert(thread < MAX_JOB_WORKERS);
+  assert(frameIndex < MAX_FRAMES_IN_FLIGHT);
+  auto familyCount = sCommandPoolFamilies.size();
+  return sCommandPools[(thread * MAX_FRAMES_IN_FLIGHT + frameIndex) * familyCount + sCommandPoolFamilySlots[role]];
+}
+
+// ============================================================================
+// Get a command buffer for recording the commands of the frame. The returned
+// command buffer is in the initial state and must only be used by the thread.
+// @param thread The index of the job worker of the calling thread.
+// @param frameIndex The index of the frame in flight.
+// @param role The queue role whose queue the command buffer is submitted to.
+// @param level The level of the command buffer.
+// @returns A handle to the command buffer.
+static VkCommandBuffer allocate_command_buffer(uint32_t thread, uint32_t frameIndex, QueueRole role, VkCommandBufferLevel level)
+{
+  auto& commandPool = get_command_pool(thread, frameIndex, role);
+  if (commandPool.pool == VK_NULL_HANDLE) {
+    // the command buffers only live until the next reset of the frame.
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.pNext = NULL;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = sQueues[role].familyIndex;
+    auto result = vkCreateCommandPool(sLogicalDevice, &poolInfo, host_allocator(), &commandPool.pool);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkCreateCommandPool failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+  }
+
+  // reuse the command buffers of the previous use of the frame.
+  auto& commandBuffers = commandPool.levels[level == VK_COMMAND_BUFFER_LEVEL_PRIMARY ? 0 : 1];
+  if (commandBuffers.used == commandBuffers.buffers.size()) {
+    VkCommandBufferAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.pNext = NULL;
+    allocateInfo.commandPool = commandPool.pool;
+    allocateInfo.level = level;
+    allocateInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    auto result = vkAllocateCommandBuffers(sLogicalDevice, &allocateInfo, &commandBuffer);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkAllocateCommandBuffers failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+    commandBuffers.buffers.push_back(commandBuffer);
+  }
+  return commandBuffers.buffers[commandBuffers.used++];
+}
+
+// ============================================================================
+// Reset all command pools of the frame at once. The timeline point of the frame
+// must have been waited, so that none of the command buffers are pending.
+// @param frameIndex The index of the frame in flight.
+static void reset_command_pools(uint32_t frameIndex)
+{
+  TraceZone zone("reset_command_pools");
+  auto familyCount = sCommandPoolFamilies.size();
+  for (uint32_t thread = 0; thread < MAX_JOB_WORKERS; thread++) {
+    for (size_t family = 0; family < familyCount; family++) {
+      auto& commandPool = sCommandPools[(thread * MAX_FRAMES_IN_FLIGHT + frameIndex) * familyCount + family];
+      if (commandPool.levels[0].used + commandPool.levels[1].used == 0) {
+        continue;
+      }
+      vkResetCommandPool(sLogicalDevice, commandPool.pool, 0);
+      commandPool.levels[0].used = 0;
+      commandPool.levels[1].used = 0;
+    }
+  }
+}
+
+// ============================================================================
+// Destroy all command pools, which also frees their command buffers.
+static void destroy_command_pools()
+{
+  uint32_t poolCount = 0;
+  size_t bufferCount = 0;
+  for (auto& commandPool : sCommandPools) {
+    if (commandPool.pool != VK_NULL_HANDLE) {
+      vkDestroyCommandPool(sLogicalDevice, commandPool.pool, host_allocator());
+      poolCount++;
+      bufferCount += commandPool.levels[0].buffers.size() + commandPool.levels[1].buffers.size();
+    }
+  }
+  if (poolCount > 0) {
+    LOG_INFO("Destroyed [%d] command pool(s) with [%d] command buffer(s).\n", poolCount, static_cast<int>(bufferCount));
+  }
+  sCommandPools.clear();
+  sCommandPoolFamilies.clear();
+}
+
+// ============================================================================
+// PARALLEL RECORDING
+// ============================================================================
+// The draw list of a frame is split into contiguous chunks, which are recorded
+// concurrently into secondary command buffers with a parallel for of the job
+// system. The main thread records the first chunk itself and then executes the
+// chunks in their original order from the primary command buffer of the frame:
+//
+//   main:     [chunk 0] ---------- wait --> vkCmdExecuteCommands(0, 1, .., N)
+//   worker a: [chunk 1] -----------^
+//   worker b: [chunk N] -----------^
+//
+// Each chunk allocates its secondary command buffer from the command pool of
+// the job worker recording it (see COMMAND POOLS), so the workers only
+// synchronize through the counter of the parallel for. Small draw lists are
+// recorded by the main thread alone, as waking the workers would cost more
+// than it saves.
+//
+// There's no geometry pipeline yet, so each draw records the dynamic state of
+// an object (viewport, scissor and blend constants), which keeps the recording
+// cost per draw representative while the secondary command buffers can still
+// be executed outside of a render pass.
+// ============================================================================
+
+// The default amount of draws in the draw list of a frame.
+#define DEFAULT_DRAW_COUNT 1024
+// The minimum amount of draws that is worth recording on a separate thread.
+#define MIN_DRAWS_PER_THREAD 64
+
+// A draw with its rectangle and color relative to the size of the target.
+struct Draw
+{
+  float x;
+  float y;
+  float width;
+  float height;
+  float color[4];
+};
+
+// The range of draws that is recorded as a chunk of a frame.
+struct RecordingJob
+{
+  uint32_t        frameIndex;
+  uint32_t        begin;
+  uint32_t        end;
+  VkExtent2D      extent;
+  VkCommandBuffer commandBuffer;
+};
+
+// The amount of draws in the draw list of each frame.
+static uint32_t sDrawCount = DEFAULT_DRAW_COUNT;
+// The user requested maximum amount of chunks or zero to use all job workers.
+static uint32_t sRecordingThreadCount = 0;
+// The draw list that is recorded for each frame.
+static std::vector<Draw> sDraws;
+// The chunks of the current frame.
+static RecordingJob sRecordingJobs[MAX_JOB_WORKERS] = {};
+
+// ============================================================================
+// Build a deterministic draw list of randomly placed and colored rectangles.
+// @param count The amount of draws.
+static void build_draw_list(uint32_t count)
+{
+  std::minstd_rand random(count);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  sDraws.resize(count);
+  for (auto& draw : sDraws) {
+    draw.width = 0.05f + 0.2f * unit(random);
+    draw.height = 0.05f + 0.2f * unit(random);
+    draw.x = (1.f - draw.width) * unit(random);
+    draw.y = (1.f - draw.height) * unit(random);
+    for (auto& channel : draw.color) {
+      channel = unit(random);
+    }
+  }
+}
+
+// ============================================================================
+// Record the draws of a job into a new secondary command buffer.
+// @param thread The index of the job worker of the calling thread.
+// @param job The job to record, which receives the secondary command buffer.
+static void record_draws(uint32_t thread, RecordingJob& job)
+{
+  if (job.begin == job.end) {
+    job.commandBuffer = VK_NULL_HANDLE;
+    return;
+  }
+  TraceZone zone("record_draws");
+  job.commandBuffer = allocate_command_buffer(thread, job.frameIndex, QUEUE_ROLE_GRAPHICS, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+  // the secondary command buffers are executed outside of a render pass.
+  VkCommandBufferInheritanceInfo inheritanceInfo = {};
+  inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritanceInfo.pNext = NULL;
+  inheritanceInfo.renderPass = VK_NULL_HANDLE;
+  inheritanceInfo.subpass = 0;
+  inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+  inheritanceInfo.occlusionQueryEnable = VK_FALSE;
+  inheritanceInfo.queryFlags = 0;
+  inheritanceInfo.pipelineStatistics = 0;
+
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.pNext = NULL;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  beginInfo.pInheritanceInfo = &inheritanceInfo;
+  auto result = vkBeginCommandBuffer(job.commandBuffer, &beginInfo);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkBeginCommandBuffer failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+
+  const auto width = static_cast<float>(job.extent.width);
+  const auto height = static_cast<float>(job.extent.height);
+  for (auto i = job.begin; i < job.end; i++) {
+    const auto& draw = sDraws[i];
+    VkViewport viewport = {};
+    viewport.x = draw.x * width;
+    viewport.y = draw.y * height;
+    viewport.width = draw.width * width;
+    viewport.height = draw.height * height;
+    viewport.minDepth = 0.f;
+    viewport.maxDepth = 1.f;
+    VkRect2D scissor = {};
+    scissor.offset.x = static_cast<int32_t>(viewport.x);
+    scissor.offset.y = static_cast<int32_t>(viewport.y);
+    scissor.extent.width = static_cast<uint32_t>(viewport.width);
+    scissor.extent.height = static_cast<uint32_t>(viewport.height);
+    vkCmdSetViewport(job.commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(job.commandBuffer, 0, 1, &scissor);
+    vkCmdSetBlendConstants(job.commandBuffer, draw.color);
+  }
+
+  result = vkEndCommandBuffer(job.commandBuffer);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkEndCommandBuffer failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+}
+
+// ============================================================================
+// Get the amount of chunks to split the draw list into.
+// @returns The user requested amount of chunks or the amount of job workers.
+static uint32_t recording_thread_count()
+{
+  return std::min(sRecordingThreadCount > 0 ? sRecordingThreadCount : job_worker_count(), job_worker_count());
+}
+
+// ============================================================================
+// Record the draw list of the frame with the job workers and execute the
+// resulting secondary command buffers from the primary command buffer.
+// @param commandBuffer The primary command buffer of the frame.
+// @param frameIndex The index of the frame in flight.
+// @param extent The size of the target image.
+static void record_draw_list(VkCommandBuffer commandBuffer, uint32_t frameIndex, VkExtent2D extent)
+{
+  if (sDraws.empty()) {
+    return;
+  }
+  TraceZone zone("record_draw_list");
+
+  // each chunk is recorded by the job worker that happens to execute it.
+  assert(job_worker_index() == 0);
+  const auto drawCount = static_cast<uint32_t>(sDraws.size());
+  const auto chunkCount = std::max(1u, std::min(recording_thread_count(), drawCount / MIN_DRAWS_PER_THREAD));
+  parallel_for(drawCount, chunkCount, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+    auto& job = sRecordingJobs[chunk];
+    job.frameIndex = frameIndex;
+    job.begin = begin;
+    job.end = end;
+    job.extent = extent;
+    record_draws(static_cast<uint32_t>(job_worker_index()), job);
+  });
+
+  // execute the chunks in the order of the draw list.
+  VkCommandBuffer secondaries[MAX_JOB_WORKERS];
+  for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+    secondaries[chunk] = sRecordingJobs[chunk].commandBuffer;
+  }
+  vkCmdExecuteCommands(commandBuffer, chunkCount, secondaries);
+}
+
+// ============================================================================
+// Create the draw list.
+static void init_parallel_recording()
+{
+  build_draw_list(sDrawCount);
+  LOG_INFO("Recording [%d] draws per frame with [%d] thread(s).\n", sDrawCount, recording_thread_count());
+}
+
+// ============================================================================
+// Release the draw list.
+static void destroy_parallel_recording()
+{
+  sDraws.clear();
+}
+
+// ============================================================================
+// Measure the host time of recording a frame with a sweep of recording thread
+// counts (up to the requested amount or the amount of workers) against the draw
+// list sizes. The frames are only recorded, they are never submitted.
+static void benchmark_recording()
+{
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+  HostMemoryPhase phase("benchmark_recording");
+  TraceZone zone("benchmark_recording");
+  vkDeviceWaitIdle(sLogicalDevice);
+
+  std::vector<uint32_t> threadCounts;
+  const auto requestedThreads = sRecordingThreadCount;
+  const auto maxThreads = recording_thread_count();
+  for (uint32_t threads = 1; threads < maxThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(maxThreads);
+  const uint32_t drawCounts[] = { 1000, 10000, 100000 };
+  const int warmupFrames = 4;
+  const int frames = 32;
+  const VkExtent2D extent = { OFFSCREEN_IMAGE_WIDTH, OFFSCREEN_IMAGE_HEIGHT };
+  LOG_INFO("Benchmarking the recording of [%d] frames (ms per frame, speedup against 1 thread):\n", frames);
+
+  std::string header = "\t   draws";
+  for (auto threads : threadCounts) {
+    char column[32];
+    snprintf(column, sizeof(column), "%16u thr", threads);
+    header += column;
+  }
+  LOG_INFO("%s\n", header.c_str());
+
+  for (auto drawCount : drawCounts) {
+    build_draw_list(drawCount);
+    char label[16];
+    snprintf(label, sizeof(label), "\t%8u", drawCount);
+    std::string row = label;
+    double singleThreaded = 0.0;
+    for (auto threads : threadCounts) {
+      sRecordingThreadCount = threads;
+      double milliseconds = 0.0;
+      for (int frame = 0; frame < warmupFrames + frames; frame++) {
+        auto startTime = std::chrono::steady_clock::now();
+        reset_command_pools(0);
+        auto commandBuffer = allocate_command_buffer(0, 0, QUEUE_ROLE_GRAPHICS, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.pNext = NULL;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = NULL;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        record_draw_list(commandBuffer, 0, extent);
+        vkEndCommandBuffer(commandBuffer);
+        if (frame >= warmupFrames) {
+          milliseconds += milliseconds_since(startTime);
+        }
+      }
+
+      milliseconds /= frames;
+      if (threads == 1) {
+        singleThreaded = milliseconds;
+      }
+      char column[32];
+      snprintf(column, sizeof(column), "%12.3f (%4.1fx)", milliseconds, singleThreaded / std::max(milliseconds, 1e-9));
+      row += column;
+    }
+    LOG_INFO("%s\n", row.c_str());
+  }
+  sRecordingThreadCount = requestedThreads;
+  reset_command_pools(0);
+}
+
+// ============================================================================
+// TIMELINES
+// ============================================================================
+// Each queue has a timeline, which is a monotonically increasing value that is
+// incremented by every submission into the queue. A submission is identified
+// by the point it signals on the timeline, so the host can wait for it, query
+// whether it's done without blocking or make a submission into another queue
+// wait for it on the device:
+//
+//   graphics: ---[1]---[2]---[3]------------[4]--->
+//                          ^                  |
+//   transfer: ----------[1]+------[2]---------'   (graphics 4 waits transfer 2)
+//
+// The timelines are built on timeline semaphores (Vulkan 1.2), which replace
+// the per-frame fences and can be waited by both the host and the device. When
+// the device lacks them, each queue submit call signals a pooled fence instead,
+// and the waits are done on the host before the submission. A submission that
+// waits for an earlier submission of the same flush is held back until the
+// earlier one has been submitted and waited for.
+//
+// The roles that share a queue (e.g. graphics and present) share the timeline.
+//
+// The submissions are not submitted right away. Instead any thread may queue
+// submissions during a frame, which reserves their points on the timeline, and
+// the main thread flushes all queued submissions of a queue with a single
+// vkQueueSubmit (or vkQueueSubmit2) call per frame. The consecutive submissions
+// without waits are merged into the previous batch of the call, which then only
+// signals the last point, as waiting for any earlier point is still satisfied
+// by the timeline value being larger. A batch that waits is never merged into,
+// so that independent work doesn't stall behind the waits of another batch.
+//
+// Each queue is externally synchronized by the queue mutex of its timeline,
+// which is held while submitting and presenting, while the queued submissions
+// are guarded by a separate mutex so that queueing never waits for a submit.
+// ============================================================================
+
+// A point on the timeline of a queue.
+struct TimelinePoint
+{
+  QueueRole role;
+  uint64_t  value;
+};
+
+// A fence signaled by a queue submit call when the timeline is emulated. The
+// fence isn't recycled while the host has threads waiting for it.
+struct TimelineFence
+{
+  uint64_t value;
+  VkFence  fence;
+  uint32_t waiters;
+};
+
+// A submission of command buffers into a queue.
+struct QueueSubmission
+{
+  std::vector<VkCommandBuffer>      commandBuffers;
+  std::vector<TimelinePoint>        waitPoints;
+  std::vector<VkPipelineStageFlags> waitPointStages;
+  VkSemaphore                       waitSemaphore;
+  VkPipelineStageFlags              waitSemaphoreStage;
+  VkSemaphore                       signalSemaphore;
+};
+
+// A queued submission with the point it signals on the timeline.
+struct QueuedSubmission
+{
+  QueueSubmission submission;
+  uint64_t        value;
+};
+
+// The timeline of a queue.
+struct Timeline
+{
+  VkQueue                       queue;
+  VkSemaphore                   semaphore;
+  std::atomic<uint64_t>         completedValue;
+  std::atomic<uint64_t>         submittedValue;
+  std::mutex                    batchMutex;
+  uint64_t                      lastValue;
+  std::vector<QueuedSubmission> queued;
+  std::mutex                    queueMutex;
+  std::vector<TimelineFence>    pendingFences;
+  std::vector<VkFence>          freeFences;
+  uint64_t                      submissionCount;
+  uint64_t                      batchCount;
+  uint64_t                      submitCount;
+};
+
+// The timelines of the distinct queues.
+static Timeline sTimelines[QUEUE_ROLE_COUNT];
+// The timeline index of each queue role.
+static uint32_t sTimelineIndices[QUEUE_ROLE_COUNT] = {};
+// The amount of distinct timelines.
+static uint32_t sTimelineCount = 0;
+// Whether the timelines use timeline semaphores instead of fences.
+static bool sTimelineSemaphores = false;
+// Whether the submissions use vkQueueSubmit2 instead of vkQueueSubmit.
+static bool sQueueSubmit2 = false;
+
+// ============================================================================
+// Get the timeline of the queue of a role.
+// @param role The queue role.
+// @returns The timeline.
+static Timeline& get_timeline(QueueRole role)
+{
+  assert(role < QUEUE_ROLE_COUNT);
+  return sTimelines[sTimelineIndices[role]];
+}
+
+// ============================================================================
+// Create a timeline for each distinct queue of the queue roles.
+static void create_timelines()
+{
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+  sTimelineSemaphores = has_device_feature(DEVICE_FEATURE_TIMELINE_SEMAPHORE)
+    && vkGetSemaphoreCounterValue != NULL
+    && vkWaitSemaphores != NULL;
+  sQueueSubmit2 = has_device_feature(DEVICE_FEATURE_SYNCHRONIZATION2) && vkQueueSubmit2 != NULL;
+
+  sTimelineCount = 0;
+  for (int role = 0; role < QUEUE_ROLE_COUNT; role++) {
+    auto queue = get_queue(static_cast<QueueRole>(role));
+    uint32_t index = 0;
+    while (index < sTimelineCount && sTimelines[index].queue != queue) {
+      index++;
+    }
+    sTimelineIndices[role] = index;
+    if (index < sTimelineCount) {
+      continue;
+    }
+
+    auto& timeline = sTimelines[sTimelineCount++];
+    timeline.queue = queue;
+    timeline.semaphore = VK_NULL_HANDLE;
+    timeline.completedValue.store(0);
+    timeline.submittedValue.store(0);
+    timeline.lastValue = 0;
+    timeline.submissionCount = 0;
+    timeline.batchCount = 0;
+    timeline.submitCount = 0;
+    if (sTimelineSemaphores) {
+      VkSemaphoreTypeCreateInfo typeInfo = {};
+      typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+      typeInfo.pNext = NULL;
+      typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+      typeInfo.initialValue = 0;
+
+      VkSemaphoreCreateInfo semaphoreInfo = {};
+      semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+      semaphoreInfo.pNext = &typeInfo;
+      semaphoreInfo.flags = 0;
+      auto result = vkCreateSemaphore(sLogicalDevice, &semaphoreInfo, host_allocator(), &timeline.semaphore);
+      if (result != VK_SUCCESS) {
+        LOG_ERROR("vkCreateSemaphore failed: %s\n", vulkan_result_description(result).c_str());
+        exit_failure();
+      }
+    }
+  }
+  LOG_INFO("Created [%d] queue timeline(s) with %s and %s.\n",
+    sTimelineCount,
+    sTimelineSemaphores ? "timeline semaphores" : "fences",
+    sQueueSubmit2 ? "vkQueueSubmit2" : "vkQueueSubmit");
+}
+
+// ============================================================================
+// Destroy the timelines. The device must be idle.
+static void destroy_timelines()
+{
+  for (uint32_t i = 0; i < sTimelineCount; i++) {
+    auto& timeline = sTimelines[i];
+    if (timeline.submitCount > 0) {
+      LOG_INFO("Queue timeline [%d]: [%llu] submission(s) in [%llu] batch(es) and [%llu] submit call(s).\n",
+        i,
+        static_cast<unsigned long long>(timeline.submissionCount),
+        static_cast<unsigned long long>(timeline.batchCount),
+        static_cast<unsigned long long>(timeline.submitCount));
+    }
+    if (!timeline.queued.empty()) {
+      LOG_WARNING("Queue timeline [%d] has [%d] submission(s) that were never flushed.\n", i, static_cast<int>(timeline.queued.size()));
+      timeline.queued.clear();
+    }
+    if (timeline.semaphore != VK_NULL_HANDLE) {
+      vkDestroySemaphore(sLogicalDevice, timeline.semaphore, host_allocator());
+      timeline.semaphore = VK_NULL_HANDLE;
+    }
+    for (const auto& pendingFence : timeline.pendingFences) {
+      vkDestroyFence(sLogicalDevice, pendingFence.fence, host_allocator());
+    }
+    for (auto fence : timeline.freeFences) {
+      vkDestroyFence(sLogicalDevice, fence, host_allocator());
+    }
+    timeline.pendingFences.clear();
+    timeline.freeFences.clear();
+    timeline.queue = VK_NULL_HANDLE;
+  }
+  sTimelineCount = 0;
+}
 
 // ============================================================================
-// Get the result description for the specified Vulkan result code.
-// @param result The target Vulkan result code.
-// @returns A result description as a string.
-static std::string vulkan_result_description(VkResult result)
+// Retire the emulated submissions whose fences have been signaled. Must be
+// called with the queue mutex of the timeline locked.
+// @param timeline The timeline.
+static void retire_timeline_fences(Timeline& timeline)
 {
-  switch (result)
-  {
-    case VK_SUCCESS:
-      return "Command successfully completed.";
-    case VK_INCOMPLETE:
-      return "A return array was too small for the result.";
-    case VK_ERROR_OUT_OF_HOST_MEMORY:
-      return "A host memory allocation has failed.";
-    case VK_ERROR_OUT_OF_DEVICE_MEMORY:
-      return "A device memory allocation has failed.";
-    case VK_ERROR_INITIALIZATION_FAILED:
-      return "Initialization of an object could not be completed.";
-    case VK_ERROR_LAYER_NOT_PRESENT:
-      return "A requested layer is not present or could not be loaded.";
-    case VK_ERROR_EXTENSION_NOT_PRESENT:
-      return "A requested extension is not supported.";
-    case VK_ERROR_INCOMPATIBLE_DRIVER:
-      return "The requested version of Vulkan is not supported by the driver.";
-    default:
-      return "An unknown result code [" + std::to_string(result) + "] occured.";
+  size_t retired = 0;
+  while (retired < timeline.pendingFences.size()) {
+    const auto& pendingFence = timeline.pendingFences[retired];
+    if (pendingFence.waiters > 0 || vkGetFenceStatus(sLogicalDevice, pendingFence.fence) != VK_SUCCESS) {
+      break;
+    }
+    vkResetFences(sLogicalDevice, 1, &pendingFence.fence);
+    timeline.freeFences.push_back(pendingFence.fence);
+    timeline.completedValue.store(pendingFence.value);
+    retired++;
   }
+  timeline.pendingFences.erase(timeline.pendingFences.begin(), timeline.pendingFences.begin() + retired);
 }
 
 // ============================================================================
-// PHYSICAL DEVICES
+// Query how far the device has progressed on the timeline of a queue without
+// blocking, e.g. to find out which resources are no longer in use.
+// @param role The queue role.
+// @returns The value of the last completed submission.
+static uint64_t gpu_progress(QueueRole role)
+{
+  auto& timeline = get_timeline(role);
+  if (sTimelineSemaphores) {
+    uint64_t value = 0;
+    auto result = vkGetSemaphoreCounterValue(sLogicalDevice, timeline.semaphore, &value);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkGetSemaphoreCounterValue failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+    timeline.completedValue.store(value);
+    return value;
+  }
+  std::lock_guard<std::mutex> lock(timeline.queueMutex);
+  retire_timeline_fences(timeline);
+  return timeline.completedValue.load();
+}
+
 // ============================================================================
-// Vulkan seperates devices into physical and logical devices.
-//
-// Physical device represents a single complete implementation of Vulkan that
-// is available for the host machine.
-//
-// Vulkan requires us to first enumerate and then select a suitable physical
-// device for our application. For this purpose, we should do following things.
-//
-//   1. Enumerate available physical devices.
-//   2. Check and rate devices based on their support to required properties.
-//   3. Check and rate devices based on their support to required features.
-//
-// In addition to previously mentioned device support checks, we also need to
-// check which queue family we can use in our processing. This is done by first
-// enumerating all device queue families and then finding the index of a queue
-// which supports our required set of features (e.g. graphics handling etc.).
-//
-// NOTE: Now we use a simple device selection, which does not score devices!
+// Check without blocking whether the device has reached a timeline point.
+// @param point The point on the timeline.
+// @returns Whether the submission of the point has completed.
+static bool timeline_reached(const TimelinePoint& point)
+{
+  return get_timeline(point.role).completedValue.load() >= point.value || gpu_progress(point.role) >= point.value;
+}
+
 // ============================================================================
+// Get the last point reserved on the timeline of a queue, which is reached
+// once all the submissions queued so far have completed.
+// @param role The queue role.
+// @returns The value of the last queued submission.
+static uint64_t timeline_last_value(QueueRole role)
+{
+  auto& timeline = get_timeline(role);
+  std::lock_guard<std::mutex> lock(timeline.batchMutex);
+  return timeline.lastValue;
+}
 
-static std::vector<VkPhysicalDevice> enumerate_physical_devices()
+// ============================================================================
+// Queue a submission of command buffers into the queue of a role. The command
+// buffers are submitted by the next flush of the queue.
+// @param role The queue role.
+// @param submission The command buffers and semaphores to submit.
+// @returns The point signaled by the submission once it has completed.
+static TimelinePoint queue_submission(QueueRole role, QueueSubmission submission)
 {
-  // calculate how many devices the host machine contains.
-  uint32_t deviceCount = 0;
-  auto result = vkEnumeratePhysicalDevices(sInstance, &deviceCount, NULL);
-  if (result != VK_SUCCESS) {
-    printf("vkEnumeratePhysicalDevices failed: %s", vulkan_result_description(result).c_str());
-    exit(EXIT_FAILURE);
+  assert(submission.waitPoints.size() == submission.waitPointStages.size());
+  auto& timeline = get_timeline(role);
+  std::lock_guard<std::mutex> lock(timeline.batchMutex);
+  const auto value = ++timeline.lastValue;
+  timeline.queued.push_back({ std::move(submission), value });
+  return { role, value };
+}
+
+static void wait_timeline(const TimelinePoint& point);
+
+// ============================================================================
+// Submit the submissions with a single queue submit call. Must be called with
+// the queue mutex of the timeline locked.
+// @param timeline The timeline.
+// @param queued The submissions taken from the queue of the timeline.
+static void submit_timeline(Timeline& timeline, const std::vector<QueuedSubmission>& queued)
+{
+  TraceZone zone("submit_timeline");
+
+  // merge the submissions without waits into the previous batch, unless that
+  // batch waits, as the merged work would then be stalled by the waits too.
+  std::vector<uint32_t> batchStarts;
+  bool batchHasWaits = false;
+  for (uint32_t i = 0; i < queued.size(); i++) {
+    const auto& submission = queued[i].submission;
+    const auto hasWaits = !submission.waitPoints.empty() || submission.waitSemaphore != VK_NULL_HANDLE;
+    if (i == 0 || hasWaits || batchHasWaits || queued[i - 1].submission.signalSemaphore != VK_NULL_HANDLE) {
+      batchStarts.push_back(i);
+      batchHasWaits = hasWaits;
+    }
   }
+  const auto batchCount = static_cast<uint32_t>(batchStarts.size());
+  batchStarts.push_back(static_cast<uint32_t>(queued.size()));
 
-  // get handles for each available device.
-  std::vector<VkPhysicalDevice> devices(deviceCount);
-  result = vkEnumeratePhysicalDevices(sInstance, &deviceCount, devices.data());
-  if (result != VK_SUCCESS) {
-    printf("vkEnumeratePhysicalDevices failed: %s", vulkan_result_description(result).c_str());
-    exit(EXIT_FAILURE);
+  // reserve the arrays up front, so that the batches can point into them.
+  size_t waitCount = 0;
+  size_t commandBufferCount = 0;
+  for (const auto& entry : queued) {
+    waitCount += entry.submission.waitPoints.size() + 1;
+    commandBufferCount += entry.submission.commandBuffers.size();
   }
+  const size_t signalCount = 2 * batchCount;
+  std::vector<VkSemaphore> semaphores;
+  std::vector<uint64_t> values;
+  std::vector<VkPipelineStageFlags> stages;
+  std::vector<VkCommandBuffer> commandBuffers;
+  semaphores.reserve(waitCount + signalCount);
+  values.reserve(waitCount + signalCount);
+  stages.reserve(waitCount + signalCount);
+  commandBuffers.reserve(commandBufferCount);
 
-  // return the results back to caller.
-  printf("Vulkan API found [%d] physical device(s).\n", deviceCount);
-  return devices;
-}
+  // each batch has its waits, command buffers and signals in contiguous ranges.
+  struct Batch
+  {
+    size_t   waitBegin;
+    size_t   waitEnd;
+    size_t   commandBufferBegin;
+    size_t   commandBufferEnd;
+    size_t   signalBegin;
+    size_t   signalEnd;
+  };
+  std::vector<Batch> batches(batchCount);
+  for (uint32_t b = 0; b < batchCount; b++) {
+    auto& batch = batches[b];
+    const auto& first = queued[batchStarts[b]].submission;
+    const auto& last = queued[batchStarts[b + 1] - 1];
 
-// ============================================================================
+    batch.waitBegin = semaphores.size();
+    if (sTimelineSemaphores) {
+      for (size_t i = 0; i < first.waitPoints.size(); i++) {
+        const auto& waitPoint = first.waitPoints[i];
+        if (timeline_reached(waitPoint)) {
+          continue;
+        }
+        semaphores.push_back(get_timeline(waitPoint.role).semaphore);
+        values.push_back(waitPoint.value);
+        stages.push_back(first.waitPointStages[i]);
+      }
+    }
+    if (first.waitSemaphore != VK_NULL_HANDLE) {
+      semaphores.push_back(first.waitSemaphore);
+      values.push_back(0);
+      stages.push_back(first.waitSemaphoreStage);
+    }
+    batch.waitEnd = semaphores.size();
 
-static std::vector<VkQueueFamilyProperties> enumerate_queue_family_properties(const VkPhysicalDevice& device)
-{
-  // calculate how many queue families the physical device supports.
-  uint32_t queueFamilyCount = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
+    batch.commandBufferBegin = commandBuffers.size();
+    for (auto i = batchStarts[b]; i < batchStarts[b + 1]; i++) {
+      const auto& submission = queued[i].submission;
+      commandBuffers.insert(commandBuffers.end(), submission.commandBuffers.begin(), submission.commandBuffers.end());
+    }
+    batch.commandBufferEnd = commandBuffers.size();
 
-  // get handles for each available queue family.
-  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+    batch.signalBegin = semaphores.size();
+    if (sTimelineSemaphores) {
+      semaphores.push_back(timeline.semaphore);
+      values.push_back(last.value);
+      stages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    }
+    if (last.submission.signalSemaphore != VK_NULL_HANDLE) {
+      semaphores.push_back(last.submission.signalSemaphore);
+      values.push_back(0);
+      stages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    }
+    batch.signalEnd = semaphores.size();
+  }
 
-  // return the results back to caller.
-  printf("Vulkan API found [%d] queue families for the target physical device.\n", queueFamilyCount);
-  return queueFamilies;
+  // the emulated timeline signals a recycled fence instead.
+  const auto lastValue = queued.back().value;
+  VkFence fence = VK_NULL_HANDLE;
+  if (!sTimelineSemaphores) {
+    retire_timeline_fences(timeline);
+    if (timeline.freeFences.empty()) {
+      VkFenceCreateInfo fenceInfo = {};
+      fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+      fenceInfo.pNext = NULL;
+      fenceInfo.flags = 0;
+      auto result = vkCreateFence(sLogicalDevice, &fenceInfo, host_allocator(), &fence);
+      if (result != VK_SUCCESS) {
+        LOG_ERROR("vkCreateFence failed: %s\n", vulkan_result_description(result).c_str());
+        exit_failure();
+      }
+    } else {
+      fence = timeline.freeFences.back();
+      timeline.freeFences.pop_back();
+    }
+  }
+
+  VkResult result = VK_SUCCESS;
+  if (sQueueSubmit2) {
+    std::vector<VkSemaphoreSubmitInfo> semaphoreInfos(semaphores.size());
+    for (size_t i = 0; i < semaphores.size(); i++) {
+      auto& semaphoreInfo = semaphoreInfos[i];
+      semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+      semaphoreInfo.pNext = NULL;
+      semaphoreInfo.semaphore = semaphores[i];
+      semaphoreInfo.value = values[i];
+      semaphoreInfo.stageMask = static_cast<VkPipelineStageFlags2>(stages[i]);
+      semaphoreInfo.deviceIndex = 0;
+    }
+    std::vector<VkCommandBufferSubmitInfo> commandBufferInfos(commandBuffers.size());
+    for (size_t i = 0; i < commandBuffers.size(); i++) {
+      auto& commandBufferInfo = commandBufferInfos[i];
+      commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+      commandBufferInfo.pNext = NULL;
+      commandBufferInfo.commandBuffer = commandBuffers[i];
+      commandBufferInfo.deviceMask = 0;
+    }
+    std::vector<VkSubmitInfo2> submitInfos(batchCount);
+    for (uint32_t b = 0; b < batchCount; b++) {
+      const auto& batch = batches[b];
+      auto& submitInfo = submitInfos[b];
+      submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+      submitInfo.pNext = NULL;
+      submitInfo.flags = 0;
+      submitInfo.waitSemaphoreInfoCount = static_cast<uint32_t>(batch.waitEnd - batch.waitBegin);
+      submitInfo.pWaitSemaphoreInfos = semaphoreInfos.data() + batch.waitBegin;
+      submitInfo.commandBufferInfoCount = static_cast<uint32_t>(batch.commandBufferEnd - batch.commandBufferBegin);
+      submitInfo.pCommandBufferInfos = commandBufferInfos.data() + batch.commandBufferBegin;
+      submitInfo.signalSemaphoreInfoCount = static_cast<uint32_t>(batch.signalEnd - batch.signalBegin);
+      submitInfo.pSignalSemaphoreInfos = semaphoreInfos.data() + batch.signalBegin;
+    }
+    result = vkQueueSubmit2(timeline.queue, batchCount, submitInfos.data(), fence);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkQueueSubmit2 failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+  } else {
+    std::vector<VkTimelineSemaphoreSubmitInfo> timelineInfos(batchCount);
+    std::vector<VkSubmitInfo> submitInfos(batchCount);
+    for (uint32_t b = 0; b < batchCount; b++) {
+      const auto& batch = batches[b];
+      auto& timelineInfo = timelineInfos[b];
+      timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+      timelineInfo.pNext = NULL;
+      timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(batch.waitEnd - batch.waitBegin);
+      timelineInfo.pWaitSemaphoreValues = values.data() + batch.waitBegin;
+      timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(batch.signalEnd - batch.signalBegin);
+      timelineInfo.pSignalSemaphoreValues = values.data() + batch.signalBegin;
+
+      auto& submitInfo = submitInfos[b];
+      submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submitInfo.pNext = sTimelineSemaphores ? &timelineInfo : NULL;
+      submitInfo.waitSemaphoreCount = static_cast<uint32_t>(batch.waitEnd - batch.waitBegin);
+      submitInfo.pWaitSemaphores = semaphores.data() + batch.waitBegin;
+      submitInfo.pWaitDstStageMask = stages.data() + batch.waitBegin;
+      submitInfo.commandBufferCount = static_cast<uint32_t>(batch.commandBufferEnd - batch.commandBufferBegin);
+      submitInfo.pCommandBuffers = commandBuffers.data() + batch.commandBufferBegin;
+      submitInfo.signalSemaphoreCount = static_cast<uint32_t>(batch.signalEnd - batch.signalBegin);
+      submitInfo.pSignalSemaphores = semaphores.data() + batch.signalBegin;
+    }
+    result = vkQueueSubmit(timeline.queue, batchCount, submitInfos.data(), fence);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkQueueSubmit failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+  }
+
+  if (fence != VK_NULL_HANDLE) {
+    timeline.pendingFences.push_back({ lastValue, fence, 0 });
+  }
+  timeline.submittedValue.store(lastValue);
+  timeline.submissionCount += queued.size();
+  timeline.batchCount += batchCount;
+  timeline.submitCount++;
 }
 
 // ============================================================================
+// Check without blocking or locking whether the wait points of a submission
+// have been reached on the emulated timelines.
+// @param entry The queued submission.
+// @returns Whether the submission may be submitted.
+static bool emulated_timeline_points_reached(const QueuedSubmission& entry)
+{
+  for (const auto& waitPoint : entry.submission.waitPoints) {
+    if (get_timeline(waitPoint.role).completedValue.load() < waitPoint.value) {
+      return false;
+    }
+  }
+  return true;
+}
 
-static std::vector<VkExtensionProperties> enumerate_available_extensions(const VkPhysicalDevice& device)
+// ============================================================================
+// Submit the queued submissions of a timeline with a single queue submit call.
+// Without timeline semaphores the submissions are submitted in rounds, where
+// each round submits the submissions up to the first one whose wait points
+// have not been reached, and then waits for its points on the host with the
+// queue unlocked, as the wait may flush and lock the timeline of another queue.
+// @param timeline The timeline.
+static void flush_timeline(Timeline& timeline)
 {
-  // calculate how many extensions the physical device supports.
-  uint32_t extensionCount = 0;
-  vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, NULL);
+  for (;;) {
+    std::vector<TimelinePoint> waitPoints;
+    {
+      std::lock_guard<std::mutex> queueLock(timeline.queueMutex);
+      std::vector<QueuedSubmission> queued;
+      {
+        std::lock_guard<std::mutex> batchLock(timeline.batchMutex);
+        queued.swap(timeline.queued);
+      }
+      if (queued.empty()) {
+        return;
+      }
 
-  // get handles for each available extension.
-  std::vector<VkExtensionProperties> extensions(extensionCount);
-  vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, extensions.data());
+      // the held back submissions keep their order in front of the new ones.
+      size_t ready = queued.size();
+      if (!sTimelineSemaphores) {
+        ready = 0;
+        while (ready < queued.size() && emulated_timeline_points_reached(queued[ready])) {
+          ready++;
+        }
+      }
+      if (ready < queued.size()) {
+        waitPoints = queued[ready].submission.waitPoints;
+        std::lock_guard<std::mutex> batchLock(timeline.batchMutex);
+        timeline.queued.insert(timeline.queued.begin(),
+                               std::make_move_iterator(queued.begin() + ready),
+                               std::make_move_iterator(queued.end()));
+        queued.resize(ready);
+      }
+      if (!queued.empty()) {
+        submit_timeline(timeline, queued);
+      }
+      if (waitPoints.empty()) {
+        return;
+      }
+    }
 
-  // return the results back to caller.
-  printf("Vulkan API found [%d] device extension(s).\n", extensionCount);
-  return extensions;
+    // the points of the same queue were submitted by this or an earlier round.
+    for (const auto& waitPoint : waitPoints) {
+      assert(&get_timeline(waitPoint.role) != &timeline || waitPoint.value <= timeline.submittedValue.load());
+      wait_timeline(waitPoint);
+    }
+  }
 }
 
 // ============================================================================
-
-static void select_vulkan_physical_device_and_queue_family()
+// Submit the queued submissions of all queues.
+static void flush_submissions()
 {
-  assert(sInstance != VK_NULL_HANDLE);
-  printf("Selecting a physical device for Vulkan.\n");
-
-  // iterate over the list of available physical devices.
-  auto devices = enumerate_physical_devices();
-  for (const auto& device : devices) {
-    // get a support information from the device.
-    VkPhysicalDeviceFeatures features;
-    VkPhysicalDeviceProperties properties;
-    vkGetPhysicalDeviceFeatures(device, &features);
-    vkGetPhysicalDeviceProperties(device, &properties);
-
-    // print out some support information.
-    printf("\t%s\n", properties.deviceName);
-    printf("\t\tsupports geometry shader:\t%d\n", features.geometryShader);
-    printf("\t\tsupports tesselation shader:\t%d\n", features.tessellationShader);
+  for (uint32_t i = 0; i < sTimelineCount; i++) {
+    flush_timeline(sTimelines[i]);
+  }
+}
 
-    std::set<std::string> requiredExtensions(DEVICE_EXTENSIONS.begin(), DEVICE_EXTENSIONS.end());
-    auto deviceExtensions = enumerate_available_extensions(device);
-    printf("\tdevice-extensions:\n");
-    for (const auto& deviceExtension : deviceExtensions) {
-      printf("\t\t%s\n", deviceExtension.extensionName);
-      requiredExtensions.erase(deviceExtension.extensionName);
+// ============================================================================
+// Block the calling thread until the device has reached a timeline point. The
+// queued submissions of the queue are flushed if the point hasn't been
+// submitted yet.
+// @param point The point on the timeline.
+static void wait_timeline(const TimelinePoint& point)
+{
+  if (timeline_reached(point)) {
+    return;
+  }
+  TraceZone zone("wait_timeline");
+  auto& timeline = get_timeline(point.role);
+  if (timeline.submittedValue.load() < point.value) {
+    flush_timeline(timeline);
+  }
+  if (sTimelineSemaphores) {
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.pNext = NULL;
+    waitInfo.flags = 0;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline.semaphore;
+    waitInfo.pValues = &point.value;
+    auto result = vkWaitSemaphores(sLogicalDevice, &waitInfo, UINT64_MAX);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkWaitSemaphores failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
     }
-    bool hasRequiredDeviceExtensions = requiredExtensions.empty();
-    printf("\tdevice has required extensions: %d\n", hasRequiredDeviceExtensions ? 1 : 0);
-
-    // check that the device has a queue family containing a support for graphics.
-    auto queueFamilies = enumerate_queue_family_properties(device);
-    for (auto i = 0u; i < queueFamilies.size(); i++) {
-      // print out some queue family information.
-      printf("\tqueue-family: %d\n", i);
-      printf("\t\tsupports graphics:\t%d\n", (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0 ? 1 : 0);
-      printf("\t\tsupports compute:\t%d\n", (queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0 ? 1 : 0);
+    gpu_progress(point.role);
+    return;
+  }
 
-      // check whether we've found our device.
-      bool supportsGraphics = (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
-      if (features.geometryShader && features.tessellationShader && supportsGraphics && hasRequiredDeviceExtensions) {
-        sPhysicalDevice = device;
-        sGraphicsQueueFamilyIndex = i;
+  // the fence is waited with the queue unlocked, so that the other threads may
+  // submit into the queue meanwhile, and the waiter keeps it from being reset.
+  VkFence fence = VK_NULL_HANDLE;
+  {
+    std::lock_guard<std::mutex> lock(timeline.queueMutex);
+    for (auto& pendingFence : timeline.pendingFences) {
+      if (pendingFence.value >= point.value) {
+        pendingFence.waiters++;
+        fence = pendingFence.fence;
+        break;
       }
+    }
+  }
+  if (fence != VK_NULL_HANDLE) {
+    auto result = vkWaitForFences(sLogicalDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkWaitForFences failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+  }
 
-      VkBool32 presentSupport = false;
-      vkGetPhysicalDeviceSurfaceSupportKHR(sPhysicalDevice, i, sSurface, &presentSupport);
-      printf("\t\tsupports present:\t%d\n", presentSupport ? 1 : 0);
-      if (presentSupport) {
-        sPresentQueueFamilyIndex = i;
-      }
+  // the earlier fences may have been retired meanwhile, but not the waited one.
+  std::lock_guard<std::mutex> lock(timeline.queueMutex);
+  for (auto& pendingFence : timeline.pendingFences) {
+    if (pendingFence.fence == fence) {
+      pendingFence.waiters--;
+      break;
     }
   }
+  retire_timeline_fences(timeline);
 }
 
 // ============================================================================
-// LOGICAL DEVICES
+// FRAMES
 // ============================================================================
-// Vulkan seperates devices into physical and logical devices.
+// The frame loop never waits for the device to become idle. Instead there are
+// N frames in flight, where the host records the commands of a frame while the
+// device is still executing the previous frames. Each frame owns command pools
+// and a semaphore, and remembers the point it signaled on the graphics timeline
+// (see TIMELINES), so the host only needs to wait for the point of the frame
+// it's about to reuse (i.e. the frame N frames ago).
 //
-// Logical device is used as an application specific interface for the physical
-// interface, which is used to store application specific definitions in Vulkan.
+//   1. Wait for the timeline point of the frame so its resources can be reused.
+//   2. Acquire a swapchain image (signals the acquire semaphore of the frame).
+//   3. Reset the command pools of the frame and record the commands.
+//   4. Submit the commands (waits the acquire semaphore, signals the present
+//      semaphore of the image and the next point on the graphics timeline).
+//   5. Present the image (waits the present semaphore of the image).
 //
-// Same physical device can be used to create multiple logical devices. In our
-// testing environment example, we now only create a single logical device.
+// In headless mode the offscreen images are used in a round-robin fashion and
+// there's nothing to acquire or present.
 // ============================================================================
 
-static void create_logical_device()
+static void create_frames()
 {
-  assert(sInstance != VK_NULL_HANDLE);
-  assert(sPhysicalDevice != VK_NULL_HANDLE);
+  assert(sLogicalDevice != VK_NULL_HANDLE);
+  assert(sFramesInFlight > 0 && sFramesInFlight <= MAX_FRAMES_IN_FLIGHT);
 
+  create_timelines();
+  init_command_pools();
+  init_parallel_recording();
+  for (uint32_t i = 0; i < sFramesInFlight; i++) {
+    auto& frame = sFrames[i];
 
-  // create a descriptor for the queues to be created for the device.
-  float queuePriority = 1.f;
-  std::set<int> queueFamilies = { sGraphicsQueueFamilyIndex, sPresentQueueFamilyIndex };
-  std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-  for (int queueFamily : queueFamilies) {
-    VkDeviceQueueCreateInfo queueCreateInfo = {};
-    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueCreateInfo.pNext = NULL;
-    queueCreateInfo.flags = 0;
-    queueCreateInfo.queueFamilyIndex = queueFamily;
-    queueCreateInfo.queueCount = 1;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
-    queueCreateInfos.push_back(queueCreateInfo);
+    // the frame hasn't been submitted yet, so the initial point is reached.
+    frame.timelineValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = NULL;
+    semaphoreInfo.flags = 0;
+    auto result = vkCreateSemaphore(sLogicalDevice, &semaphoreInfo, host_allocator(), &frame.acquireSemaphore);
+    if (result != VK_SUCCESS) {
+      LOG_ERROR("vkCreateSemaphore failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
   }
+  LOG_INFO("Created resources for [%d] frames in flight.\n", sFramesInFlight);
+}
 
-  // specify a structure of which device features we will use.
-  VkPhysicalDeviceFeatures deviceFeatures = {};
+// ============================================================================
 
-  // create a descriptor for a new logical device.
-  VkDeviceCreateInfo createInfo;
-  createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  createInfo.pNext = NULL;
-  createInfo.flags = 0;
-  createInfo.pQueueCreateInfos = queueCreateInfos.data();
-  createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
-  createInfo.pEnabledFeatures = &deviceFeatures;
-  createInfo.enabledExtensionCount = DEVICE_EXTENSIONS.size();
-  createInfo.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
-  if (enableValidationLayers) {
-    createInfo.enabledLayerCount = static_cast<uint32_t>(VALIDATION_LAYERS.size());
-    createInfo.ppEnabledLayerNames = VALIDATION_LAYERS.data();
-  } else {
-    createInfo.enabledLayerCount = 0;
-    createInfo.ppEnabledLayerNames = NULL;
+static void destroy_frames()
+{
+  for (auto& frame : sFrames) {
+    if (frame.acquireSemaphore != VK_NULL_HANDLE) {
+      vkDestroySemaphore(sLogicalDevice, frame.acquireSemaphore, host_allocator());
+    }
+    frame = {};
   }
+  destroy_parallel_recording();
+  destroy_command_pools();
+  destroy_timelines();
+}
 
-  // try to create the logical device with the descriptor.
-  auto result = vkCreateDevice(sPhysicalDevice, &createInfo, nullptr, &sLogicalDevice);
+// ============================================================================
+// Record the commands to render into the target image.
+// @param commandBuffer The command buffer to record into.
+// @param frameIndex The index of the frame in flight.
+// @param image The target image.
+// @param finalLayout The layout of the image after the commands.
+static void record_frame(VkCommandBuffer commandBuffer, uint32_t frameIndex, VkImage image, VkImageLayout finalLayout)
+{
+  TraceZone zone("record_frame");
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.pNext = NULL;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  beginInfo.pInheritanceInfo = NULL;
+  auto result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
   if (result != VK_SUCCESS) {
-    printf("vkCreateDevice failed: %s", vulkan_result_description(result).c_str());
-    exit(EXIT_FAILURE);
+    LOG_ERROR("vkBeginCommandBuffer failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+  gpu_profiler_begin_frame(commandBuffer, frameIndex);
+  gpu_zone_begin(commandBuffer, "frame");
+
+  VkImageSubresourceRange range = {};
+  range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  range.baseMipLevel = 0;
+  range.levelCount = 1;
+  range.baseArrayLayer = 0;
+  range.layerCount = 1;
+
+  // the previous contents are discarded as the whole image is cleared.
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.pNext = NULL;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = range;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+  // cycle the clear color so that the progress of the frames is visible.
+  VkClearColorValue color = {};
+  color.float32[0] = (sFrameNumber % 256) / 255.f;
+  color.float32[1] = 0.2f;
+  color.float32[2] = 0.4f;
+  color.float32[3] = 1.f;
+  {
+    GpuProfilerZone zone(commandBuffer, "clear");
+    vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+  }
+  {
+    GpuProfilerZone zone(commandBuffer, "draws");
+    auto extent = sSwapchainExtent;
+    if (sHeadless) {
+      extent.width = OFFSCREEN_IMAGE_WIDTH;
+      extent.height = OFFSCREEN_IMAGE_HEIGHT;
+    }
+    record_draw_list(commandBuffer, frameIndex, extent);
   }
 
-  // get the handle to the presentation queue.
-  vkGetDeviceQueue(sLogicalDevice, sPresentQueueFamilyIndex, 0, &sPresentQueue);
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = 0;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = finalLayout;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+  gpu_zone_end(commandBuffer);
 
-  printf("Created a new Vulkan logical device for the application.\n");
+  result = vkEndCommandBuffer(commandBuffer);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkEndCommandBuffer failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
 }
 
 // ============================================================================
-// WINDOW SURFACES
-// ============================================================================
-//
-// ============================================================================
-
-static void create_window_surface()
+// Render and present the next frame without waiting for the device to idle.
+static void render_frame()
 {
-  // create a descriptor to create a Vulkan window surface.
-  VkWin32SurfaceCreateInfoKHR createInfo = {};
-  createInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-  createInfo.hwnd = sHWND;
-  createInfo.hinstance = GetModuleHandle(nullptr);
+  HostMemoryPhase phase("render_frame");
+  TraceZone zone("render_frame");
+  auto frameIndex = static_cast<uint32_t>(sFrameNumber % sFramesInFlight);
+  auto& frame = sFrames[frameIndex];
+
+  // wait until the device has finished the previous use of the frame.
+  wait_timeline({ QUEUE_ROLE_GRAPHICS, frame.timelineValue });
+  gpu_profiler_collect(frameIndex);
+  release_retired_swapchains();
+  drain_debug_messages();
+
+  // acquire the next image to render into.
+  uint32_t imageIndex = 0;
+  if (sHeadless) {
+    imageIndex = frameIndex;
+  } else {
+    if (sSwapchainOutOfDate) {
+      create_swapchain();
+      if (sWindowMinimized) {
+        return;
+      }
+    }
+    auto result = vkAcquireNextImageKHR(sLogicalDevice, sSwapchain, UINT64_MAX, frame.acquireSemaphore, VK_NULL_HANDLE, &imageIndex);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+      sSwapchainOutOfDate = true;
+      return;
+    } else if (result == VK_SUBOPTIMAL_KHR) {
+      sSwapchainOutOfDate = true;
+    } else if (result != VK_SUCCESS) {
+      LOG_ERROR("vkAcquireNextImageKHR failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
+  }
 
-  // explicitly load the necessary surface creation function.
-  auto function = (PFN_vkCreateWin32SurfaceKHR) vkGetInstanceProcAddr(sInstance, "vkCreateWin32SurfaceKHR");
-  if (!function) {
-    printf("vkGetInstanceProc failed: unable to find vkCreateWin32SurfaceKHR.\n");
-    exit(EXIT_FAILURE);
+  reset_command_pools(frameIndex);
+  auto commandBuffer = allocate_command_buffer(0, frameIndex, QUEUE_ROLE_GRAPHICS, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+  if (sHeadless) {
+    record_frame(commandBuffer, frameIndex, sOffscreenImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+  } else {
+    record_frame(commandBuffer, frameIndex, sSwapchainImages[imageIndex], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
   }
 
-  // try to create a new window surface.
-  auto result = function(sInstance, &createInfo, nullptr, &sSurface);
-  if (result != VK_SUCCESS) {
-    printf("vkCreateWin32SurfaceKHR failed: %s\n", vulkan_result_description(result).c_str());
-    exit(EXIT_FAILURE);
+  // submit the commands, which signals the next point on the graphics timeline.
+  QueueSubmission submission = {};
+  submission.commandBuffers.push_back(commandBuffer);
+  submission.waitSemaphore = sHeadless ? VK_NULL_HANDLE : frame.acquireSemaphore;
+  submission.waitSemaphoreStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  submission.signalSemaphore = sHeadless ? VK_NULL_HANDLE : sPresentSemaphores[imageIndex];
+  frame.timelineValue = queue_submission(QUEUE_ROLE_GRAPHICS, std::move(submission)).value;
+  flush_submissions();
+
+  // queue the image for the presentation.
+  if (!sHeadless) {
+    VkPresentInfoKHR presentInfo = {};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.pNext = NULL;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &sPresentSemaphores[imageIndex];
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &sSwapchain;
+    presentInfo.pImageIndices = &imageIndex;
+    presentInfo.pResults = NULL;
+    std::unique_lock<std::mutex> lock(get_timeline(QUEUE_ROLE_PRESENT).queueMutex);
+    auto result = vkQueuePresentKHR(get_queue(QUEUE_ROLE_PRESENT), &presentInfo);
+    lock.unlock();
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+      sSwapchainOutOfDate = true;
+    } else if (result != VK_SUCCESS) {
+      LOG_ERROR("vkQueuePresentKHR failed: %s\n", vulkan_result_description(result).c_str());
+      exit_failure();
+    }
   }
-  printf("Create a new window surface for the application.\n");
+  sFrameNumber++;
 }
 
 // ============================================================================
 
-static void init_vulkan()
+static void enumerate_instance_layers_and_extensions()
 {
+  // the layers and extensions are known if the snapshot could be used.
+  if (sSnapshotInstanceCapabilities) {
+    LOG_INFO("Found [%d] Vulkan layer(s) and [%d] extension(s) in the capability snapshot.\n",
+      static_cast<int>(sInstanceLayers.size()),
+      static_cast<int>(sInstanceExtensions.size()));
+    return;
+  }
+
   // ==========================================================================
   // VALIDATION LAYERS
   // ==========================================================================
@@ -359,23 +6994,26 @@ static void init_vulkan()
   uint32_t layerCount = 0;
   auto result = vkEnumerateInstanceLayerProperties(&layerCount, NULL);
   if (result != VK_SUCCESS) {
-    printf("vkEnumerateInstanceLayerProperties failed: %s", vulkan_result_description(result).c_str());
-    exit(EXIT_FAILURE);
+    LOG_ERROR("vkEnumerateInstanceLayerProperties failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
   }
 
   // gather information about the extensions.
   std::vector<VkLayerProperties> layers(layerCount);
   result = vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
   if (result != VK_SUCCESS) {
-    printf("vkEnumerateInstanceLayerProperties failed: %s", vulkan_result_description(result).c_str());
-    exit(EXIT_FAILURE);
+    LOG_ERROR("vkEnumerateInstanceLayerProperties failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
   }
 
   // print out the list of supported extensions.
-  printf("Found [%d] supported Vulkan layers(s):\n", layerCount);
+  LOG_INFO("Found [%d] supported Vulkan layers(s):\n", layerCount);
+  sInstanceLayers.clear();
   for (const auto& layer : layers) {
-    printf("\t%s\n", layer.layerName);
+    LOG_DEBUG("\t%s\n", layer.layerName);
+    sInstanceLayers.push_back(capability_name(layer.layerName));
   }
+  sort_capability_names(sInstanceLayers);
 
   // ==========================================================================
   // EXTENSIONS
@@ -400,28 +7038,179 @@ static void init_vulkan()
   // 3. If pPropertyCount is not 0 then pProperties must be a valid array.
   // ==========================================================================
 
-  // calculate the amount of possible extensions.
-  uint32_t extensionCount = 0;
-  result = vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, NULL);
-  if (result != VK_SUCCESS) {
-    printf("vkEnumerateInstanceExtensionProperties failed: %s", vulkan_result_description(result).c_str());
-    exit(EXIT_FAILURE);
+  // calculate the amount of possible extensions.
+  uint32_t extensionCount = 0;
+  result = vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, NULL);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkEnumerateInstanceExtensionProperties failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+
+  // gather information about the extensions.
+  std::vector<VkExtensionProperties> extensions(extensionCount);
+  result = vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, extensions.data());
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("vkEnumerateInstanceExtensionProperties failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
+  }
+
+  // print out the list of supported extensions.
+  LOG_INFO("Found [%d] supported Vulkan extension(s):\n", extensionCount);
+  sInstanceExtensions.clear();
+  for (const auto& extension : extensions) {
+    LOG_DEBUG("\t%s\n", extension.extensionName);
+    sInstanceExtensions.push_back(capability_name(extension.extensionName));
+  }
+  sort_capability_names(sInstanceExtensions);
+  sCapabilitySnapshotStale = true;
+}
+
+// ============================================================================
+// Check whether a layer implements the specified instance extension.
+// @param layer The name of the layer.
+// @param extension The name of the extension.
+// @returns true if the layer implements the extension.
+static bool layer_has_extension(const char* layer, const char* extension)
+{
+  uint32_t extensionCount = 0;
+  auto result = vkEnumerateInstanceExtensionProperties(layer, &extensionCount, NULL);
+  if (result != VK_SUCCESS) {
+    return false;
+  }
+  std::vector<VkExtensionProperties> extensions(extensionCount);
+  result = vkEnumerateInstanceExtensionProperties(layer, &extensionCount, extensions.data());
+  if (result != VK_SUCCESS && result != VK_INCOMPLETE) {
+    return false;
+  }
+  for (uint32_t i = 0; i < extensionCount; i++) {
+    if (strcmp(extensions[i].extensionName, extension) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// ============================================================================
+// Check whether the instance extension is implemented by the loader, by the
+// implementations or by one of the enabled layers.
+// @param extension The name of the extension.
+// @returns true if the extension is available.
+static bool instance_extension_available(const char* extension)
+{
+  if (has_capability(sInstanceExtensions, extension)) {
+    return true;
+  }
+  for (const auto& layer : sEnabledLayers) {
+    if (layer_has_extension(layer, extension)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// ============================================================================
+// Select the instance layers and extensions to be enabled. The layers and the
+// optional extensions are probed against the enumerated layers and extensions
+// and the missing ones are skipped with a warning, so that e.g. a machine that
+// has no Vulkan SDK installed can still be run with the validation requested.
+static void select_instance_layers_and_extensions()
+{
+  sEnabledLayers.clear();
+  sEnabledInstanceExtensions.clear();
+  sValidationEnabled = false;
+  sBestPracticesEnabled = false;
+
+  auto enable = [](std::vector<const char*>& names, const char* name) {
+    for (const auto& enabled : names) {
+      if (strcmp(enabled, name) == 0) {
+        return;
+      }
+    }
+    names.push_back(name);
+  };
+
+  // the validation layer is followed by the user requested layers.
+  std::vector<const char*> layers;
+  if (sUseValidation) {
+    layers.push_back(VALIDATION_LAYER);
+  }
+  for (const auto& layer : sRequestedLayers) {
+    layers.push_back(layer.c_str());
+  }
+  for (const auto& layer : layers) {
+    if (has_capability(sInstanceLayers, layer)) {
+      enable(sEnabledLayers, layer);
+    } else {
+      LOG_WARNING("Skipping the unavailable layer: %s\n", layer);
+    }
   }
 
-  // gather information about the extensions.
-  std::vector<VkExtensionProperties> extensions(extensionCount);
-  result = vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, extensions.data());
-  if (result != VK_SUCCESS) {
-    printf("vkEnumerateInstanceExtensionProperties failed: %s", vulkan_result_description(result).c_str());
-    exit(EXIT_FAILURE);
+  // the surface extensions are mandatory for presenting into the window.
+  if (!sHeadless) {
+    for (const auto& extension : SURFACE_EXTENSIONS) {
+      if (!has_capability(sInstanceExtensions, extension)) {
+        LOG_ERROR("Missing a required instance extension: %s\n", extension);
+        exit_failure();
+      }
+      enable(sEnabledInstanceExtensions, extension);
+    }
   }
 
-  // print out the list of supported extensions.
-  printf("Found [%d] supported Vulkan extension(s):\n", extensionCount);
-  for (const auto& extension : extensions) {
-    printf("\t%s\n", extension.extensionName);
+  // the messages of the validation layer are received with the debug utils.
+  auto validationLayer = std::find_if(sEnabledLayers.begin(), sEnabledLayers.end(), [](const char* layer) {
+    return strcmp(layer, VALIDATION_LAYER) == 0;
+  });
+  if (validationLayer != sEnabledLayers.end()) {
+    if (instance_extension_available(VK_EXT_DEBUG_UTILS_EXTENSION_NAME)) {
+      enable(sEnabledInstanceExtensions, VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+      sValidationEnabled = true;
+    } else {
+      LOG_WARNING("Validation messages are not received without %s.\n", VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+    }
+  }
+  if (sUseBestPractices) {
+    if (!sValidationEnabled) {
+      LOG_WARNING("Best practices checks require the validation layer.\n");
+    } else if (!layer_has_extension(VALIDATION_LAYER, VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME)) {
+      LOG_WARNING("Best practices checks require %s.\n", VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+    } else {
+      enable(sEnabledInstanceExtensions, VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+      sBestPracticesEnabled = true;
+    }
+  }
+
+  // the user requested extensions may also be implemented by the layers.
+  for (const auto& extension : sRequestedInstanceExtensions) {
+    if (instance_extension_available(extension.c_str())) {
+      enable(sEnabledInstanceExtensions, extension.c_str());
+    } else {
+      LOG_WARNING("Skipping the unavailable instance extension: %s\n", extension.c_str());
+    }
+  }
+}
+
+// ============================================================================
+// Negotiate the API version of the instance with the loader.
+static void negotiate_instance_api_version()
+{
+  if (sLoaderVersion < VK_API_VERSION_1_1) {
+    // the version 1.0 loaders reject all other API versions.
+    sInstanceApiVersion = VK_API_VERSION_1_0;
+  } else {
+    sInstanceApiVersion = std::min(api_version_minor(sLoaderVersion), MAX_API_VERSION);
   }
+  LOG_INFO("Using the Vulkan API version %d.%d (loader %d.%d.%d).\n",
+    VK_API_VERSION_MAJOR(sInstanceApiVersion),
+    VK_API_VERSION_MINOR(sInstanceApiVersion),
+    VK_API_VERSION_MAJOR(sLoaderVersion),
+    VK_API_VERSION_MINOR(sLoaderVersion),
+    VK_API_VERSION_PATCH(sLoaderVersion));
+}
+
+// ============================================================================
 
+static void create_instance()
+{
   // ==========================================================================
   // VkApplicationInfo - Structure specifying application information.
   // This is optional, but can be useful when debugging.
@@ -443,7 +7232,8 @@ static void init_vulkan()
   applicationInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
   applicationInfo.pEngineName = "Vulkan Sandbox Engine";
   applicationInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  applicationInfo.apiVersion = VK_MAKE_VERSION(1, 0, 0);
+  negotiate_instance_api_version();
+  applicationInfo.apiVersion = sInstanceApiVersion;
 
   // ==========================================================================
   // VkInstanceCreateInfo - Structure specifying parameters for an instance.
@@ -469,24 +7259,40 @@ static void init_vulkan()
   instanceInfo.pNext = NULL;
   instanceInfo.flags = 0;
   instanceInfo.pApplicationInfo = &applicationInfo;
-  if (enableValidationLayers) {
-    instanceInfo.enabledLayerCount = static_cast<uint32_t>(VALIDATION_LAYERS.size());
-    instanceInfo.ppEnabledLayerNames = VALIDATION_LAYERS.data();
-    instanceInfo.enabledExtensionCount = static_cast<uint32_t>(EXTENSIONS.size());
-    instanceInfo.ppEnabledExtensionNames = EXTENSIONS.data();
-    printf("Enabled [%d] validation layers:\n", instanceInfo.enabledLayerCount);
-    for (const auto& validationLayer : VALIDATION_LAYERS) {
-      printf("\t%s\n", validationLayer);
-    }
-    printf("Enabled [%d] extensions:\n", instanceInfo.enabledExtensionCount);
-    for (const auto& extension : EXTENSIONS) {
-      printf("\t%s\n", extension);
+  select_instance_layers_and_extensions();
+  instanceInfo.enabledLayerCount = static_cast<uint32_t>(sEnabledLayers.size());
+  instanceInfo.ppEnabledLayerNames = sEnabledLayers.empty() ? NULL : sEnabledLayers.data();
+  instanceInfo.enabledExtensionCount = static_cast<uint32_t>(sEnabledInstanceExtensions.size());
+  instanceInfo.ppEnabledExtensionNames = sEnabledInstanceExtensions.empty() ? NULL : sEnabledInstanceExtensions.data();
+  LOG_INFO("Enabled [%d] layers:\n", instanceInfo.enabledLayerCount);
+  for (const auto& layer : sEnabledLayers) {
+    LOG_INFO("\t%s\n", layer);
+  }
+  LOG_INFO("Enabled [%d] extensions:\n", instanceInfo.enabledExtensionCount);
+  for (const auto& extension : sEnabledInstanceExtensions) {
+    LOG_INFO("\t%s\n", extension);
+  }
+
+  // receive the messages of the instance creation and destruction as well.
+  VkDebugUtilsMessengerCreateInfoEXT debugMessengerInfo;
+  VkValidationFeaturesEXT validationFeatures;
+  const VkValidationFeatureEnableEXT enabledValidationFeatures[] = {
+    VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT
+  };
+  reset_debug_messages();
+  if (sValidationEnabled) {
+    fill_debug_messenger_info(debugMessengerInfo);
+    instanceInfo.pNext = &debugMessengerInfo;
+    if (sBestPracticesEnabled) {
+      validationFeatures = {};
+      validationFeatures.sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT;
+      validationFeatures.pNext = NULL;
+      validationFeatures.enabledValidationFeatureCount = 1;
+      validationFeatures.pEnabledValidationFeatures = enabledValidationFeatures;
+      validationFeatures.disabledValidationFeatureCount = 0;
+      validationFeatures.pDisabledValidationFeatures = NULL;
+      debugMessengerInfo.pNext = &validationFeatures;
     }
-  } else {
-    instanceInfo.enabledLayerCount = 0;
-    instanceInfo.ppEnabledLayerNames = NULL;
-    instanceInfo.enabledExtensionCount = 0;
-    instanceInfo.ppEnabledExtensionNames = NULL;
   }
 
   // ==========================================================================
@@ -509,29 +7315,92 @@ static void init_vulkan()
   // 2. pAllocator must be NULL or a pointer to VkAllocationCallbacks.
   // 3. pInstance must be a pointer to a VkInstance handle.
   // ==========================================================================
-  result = vkCreateInstance(&instanceInfo, NULL, &sInstance);
+  auto result = vkCreateInstance(&instanceInfo, host_allocator(), &sInstance);
   if (result != VK_SUCCESS) {
-    printf("vkCreateInstance failed: %s\n", vulkan_result_description(result).c_str());
-    exit(EXIT_FAILURE);
+    LOG_ERROR("vkCreateInstance failed: %s\n", vulkan_result_description(result).c_str());
+    exit_failure();
   }
+  load_vulkan_instance_functions();
+  if (sValidationEnabled) {
+    create_debug_messenger();
+  }
+}
 
-  create_window_surface();
-  select_vulkan_physical_device_and_queue_family();
-  create_logical_device();
+// ============================================================================
+
+static void create_render_targets()
+{
+  if (sHeadless) {
+    create_offscreen_images();
+  } else {
+    create_swapchain();
+  }
 }
 
 // ============================================================================
 
-static void shutdown()
+static void destroy_vulkan()
 {
   if (sInstance != NULL) {
-    vkDestroyDevice(sLogicalDevice, NULL);
-    vkDestroySurfaceKHR(sInstance, sSurface, NULL);
-    vkDestroyInstance(sInstance, NULL);
-    printf("vkDestroyInstance succeeded.");
+    // the frames in flight may still be executed by the device.
+    if (sLogicalDevice != VK_NULL_HANDLE) {
+      vkDeviceWaitIdle(sLogicalDevice);
+    }
+    if (sPipelineCache != VK_NULL_HANDLE) {
+      save_pipeline_cache();
+      vkDestroyPipelineCache(sLogicalDevice, sPipelineCache, host_allocator());
+    }
+    destroy_gpu_profiler();
+    destroy_frames();
+    destroy_swapchain();
+    destroy_offscreen_images();
+    destroy_device_memory();
+    if (sLogicalDevice != VK_NULL_HANDLE) {
+      vkDestroyDevice(sLogicalDevice, host_allocator());
+    }
+    if (sSurface != VK_NULL_HANDLE) {
+      vkDestroySurfaceKHR(sInstance, sSurface, host_allocator());
+    }
+    destroy_debug_messenger();
+    vkDestroyInstance(sInstance, host_allocator());
+    LOG_INFO("vkDestroyInstance succeeded.\n");
+    print_debug_message_statistics();
+    print_performance_report();
+  }
+
+  // reset the state so that the initialization can be repeated.
+  sInstance = VK_NULL_HANDLE;
+  sPhysicalDevice = VK_NULL_HANDLE;
+  sLogicalDevice = VK_NULL_HANDLE;
+  sSurface = VK_NULL_HANDLE;
+  sPipelineCache = VK_NULL_HANDLE;
+  for (auto& queue : sQueues) {
+    queue = {};
   }
+  sDeviceCapabilities.clear();
+  sPhysicalDeviceCapabilities = {};
+  sCalibratedTimestamps = false;
+  sGpuClockCalibrated = false;
+  sDeviceApiVersion = VK_API_VERSION_1_0;
+  sDeviceFeatures = 0;
+  sFrameNumber = 0;
+  reset_vulkan_functions();
+}
+
+// ============================================================================
+
+static void shutdown()
+{
+  HostMemoryPhase phase("shutdown");
+  destroy_vulkan();
+  stop_job_system();
+  unload_vulkan_library();
+  write_trace_file();
+  dump_host_memory_statistics();
+  destroy_host_allocator();
 }
 
+#ifdef _WIN32
 // ============================================================================
 // WINAPI - Window process callback.
 // ============================================================================
@@ -545,6 +7414,17 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
     case WM_DESTROY:
       PostQuitMessage(0);
       break;
+    case WM_SIZE:
+      sWindowMinimized = wParam == SIZE_MINIMIZED;
+      if (LOWORD(lParam) != sSwapchainExtent.width || HIWORD(lParam) != sSwapchainExtent.height) {
+        sSwapchainOutOfDate = true;
+      }
+      break;
+    case WM_KEYDOWN:
+      if (wParam == VK_F1) {
+        dump_host_memory_statistics();
+      }
+      break;
   }
   return DefWindowProc(hwnd, msg, wParam, lParam);
 }
@@ -576,7 +7456,7 @@ static void register_window_class()
 
   // try to register the new class.
   if (RegisterClassEx(&wc) == 0) {
-    printf("RegisterClassEx: %ld\n", GetLastError());
+    LOG_ERROR("RegisterClassEx: %ld\n", GetLastError());
     exit(-1);
   }
   atexit(unregister_window_class);
@@ -605,8 +7485,8 @@ static void create_window()
     800, 600,
     NULL, NULL, GetModuleHandle(nullptr), NULL);
   if (sHWND == nullptr) {
-    printf("CreateWindowEx: %ld\n", GetLastError());
-    exit(EXIT_FAILURE);
+    LOG_ERROR("CreateWindowEx: %ld\n", GetLastError());
+    exit_failure();
   }
   atexit(destroy_window);
 }
@@ -618,31 +7498,686 @@ static void init_window()
   register_window_class();
   create_window();
 }
+#endif
+
+// ============================================================================
+// Check whether the argument starts with the specified prefix.
+// @param argument The command line argument.
+// @param prefix The prefix of the argument (e.g. "--device=").
+// @param value The remainder of the argument after the prefix.
+// @returns true if the argument started with the prefix.
+static bool match_argument(const std::string& argument, const char* prefix, std::string& value)
+{
+  auto length = strlen(prefix);
+  if (argument.compare(0, length, prefix) != 0) {
+    return false;
+  }
+  value = argument.substr(length);
+  return true;
+}
+
+// ============================================================================
+// Split a comma separated list of names into the list of names.
+// @param value The comma separated list of names.
+// @param names The list where the non-empty names are appended.
+static void split_names(const std::string& value, std::vector<std::string>& names)
+{
+  size_t begin = 0;
+  while (begin <= value.size()) {
+    auto end = value.find(',', begin);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+    if (end > begin) {
+      names.push_back(value.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+}
+
+// ============================================================================
+// Parse the comma separated graphics, compute and transfer queue priorities.
+// @param value The comma separated list of queue priorities.
+static void parse_queue_priorities(const std::string& value)
+{
+  const QueueRole roles[] = { QUEUE_ROLE_GRAPHICS, QUEUE_ROLE_COMPUTE, QUEUE_ROLE_TRANSFER };
+  const char* c = value.c_str();
+  const auto roleCount = sizeof(roles) / sizeof(roles[0]);
+  for (size_t i = 0; i < roleCount; i++) {
+    char* end = nullptr;
+    auto priority = strtof(c, &end);
+    // each value must be followed by a comma, except the last by the end.
+    auto separator = (i + 1 < roleCount) ? ',' : '\0';
+    if (end == c || *end != separator || priority < 0.f || priority > 1.f) {
+      LOG_ERROR("Invalid queue priorities (expected three values in [0, 1]): %s\n", value.c_str());
+      exit_failure();
+    }
+    sQueuePriorities[roles[i]] = priority;
+    c = end + 1;
+  }
+  sQueuePriorities[QUEUE_ROLE_PRESENT] = sQueuePriorities[QUEUE_ROLE_GRAPHICS];
+}
+
+// ============================================================================
+// Parse the amount of frames in flight.
+// @param value The amount of frames in flight.
+static void parse_frames_in_flight(const std::string& value)
+{
+  auto framesInFlight = strtoul(value.c_str(), nullptr, 10);
+  if (framesInFlight < 1 || framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+    LOG_ERROR("Invalid amount of frames in flight (expected 1-%d): %s\n", MAX_FRAMES_IN_FLIGHT, value.c_str());
+    exit_failure();
+  }
+  sFramesInFlight = static_cast<uint32_t>(framesInFlight);
+}
+
+// ============================================================================
+// Parse the name of the requested presentation mode.
+// @param value The name of the presentation mode.
+static void parse_present_mode(const std::string& value)
+{
+  const VkPresentModeKHR presentModes[] = {
+    VK_PRESENT_MODE_IMMEDIATE_KHR,
+    VK_PRESENT_MODE_MAILBOX_KHR,
+    VK_PRESENT_MODE_FIFO_KHR,
+    VK_PRESENT_MODE_FIFO_RELAXED_KHR
+  };
+  for (auto presentMode : presentModes) {
+    if (value == present_mode_name(presentMode)) {
+      sPresentModeOverride = presentMode;
+      return;
+    }
+  }
+  LOG_ERROR("Invalid presentation mode (expected immediate, mailbox, fifo or fifo-relaxed): %s\n", value.c_str());
+  exit_failure();
+}
+
+// ============================================================================
+// Parse the comma separated list of the optional device features.
+// @param value The list of feature names, "all" or "none".
+// @returns The bits of the listed device features.
+static uint32_t parse_device_features(const std::string& value)
+{
+  std::vector<std::string> names;
+  split_names(value, names);
+  uint32_t features = 0;
+  for (const auto& name : names) {
+    if (name == "all") {
+      features = DEVICE_FEATURE_BIT(DEVICE_FEATURE_COUNT) - 1;
+      continue;
+    } else if (name == "none") {
+      continue;
+    }
+    int feature = 0;
+    while (feature < DEVICE_FEATURE_COUNT && name != DEVICE_FEATURES[feature].name) {
+      feature++;
+    }
+    if (feature == DEVICE_FEATURE_COUNT) {
+      LOG_ERROR("Invalid device feature: %s\n", name.c_str());
+      exit_failure();
+    }
+    features |= DEVICE_FEATURE_BIT(feature);
+  }
+  return features;
+}
+
+// ============================================================================
+// Parse the amount of threads.
+// @param value The amount of threads.
+// @param name The name of the threads used in the error message.
+// @returns The amount of threads.
+static uint32_t parse_thread_count(const std::string& value, const char* name)
+{
+  auto threads = strtoul(value.c_str(), nullptr, 10);
+  if (threads < 1 || threads > MAX_JOB_WORKERS) {
+    LOG_ERROR("Invalid amount of %s (expected 1-%d): %s\n", name, MAX_JOB_WORKERS, value.c_str());
+    exit_failure();
+  }
+  return static_cast<uint32_t>(threads);
+}
+
+// ============================================================================
+// Parse a single command line argument.
+// @param argument The command line argument.
+static void parse_argument(const std::string& argument)
+{
+  std::string value;
+  if (match_argument(argument, "--device=", value)) {
+    sDeviceOverride = value;
+  } else if (match_argument(argument, "--queue-priorities=", value)) {
+    parse_queue_priorities(value);
+  } else if (match_argument(argument, "--present-mode=", value)) {
+    parse_present_mode(value);
+  } else if (match_argument(argument, "--device-features=", value)) {
+    sRequestedDeviceFeatures = parse_device_features(value);
+  } else if (match_argument(argument, "--required-device-features=", value)) {
+    sRequiredDeviceFeatures = parse_device_features(value);
+  } else if (match_argument(argument, "--frames-in-flight=", value)) {
+    parse_frames_in_flight(value);
+  } else if (match_argument(argument, "--recording-threads=", value)) {
+    sRecordingThreadCount = parse_thread_count(value, "recording threads");
+  } else if (match_argument(argument, "--job-workers=", value)) {
+    sRequestedJobWorkerCount = parse_thread_count(value, "job workers");
+  } else if (match_argument(argument, "--draws=", value)) {
+    sDrawCount = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+  } else if (match_argument(argument, "--frames=", value)) {
+    sFrameLimit = strtoull(value.c_str(), nullptr, 10);
+  } else if (argument == "--headless") {
+    sHeadless = true;
+  } else if (match_argument(argument, "--bench-startup=", value)) {
+    sBenchStartupCount = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+  } else if (argument == "--bench-device-memory") {
+    sBenchDeviceMemory = true;
+  } else if (argument == "--bench-recording") {
+    sBenchRecording = true;
+  } else if (match_argument(argument, "--trace=", value)) {
+    sUseTrace = true;
+    sTracePath = value;
+  } else if (argument == "--validation") {
+    sUseValidation = true;
+  } else if (argument == "--no-validation") {
+    sUseValidation = false;
+    sUseBestPractices = false;
+  } else if (argument == "--best-practices") {
+    sUseValidation = true;
+    sUseBestPractices = true;
+  } else if (match_argument(argument, "--layers=", value)) {
+    split_names(value, sRequestedLayers);
+  } else if (match_argument(argument, "--instance-extensions=", value)) {
+    split_names(value, sRequestedInstanceExtensions);
+  } else if (match_argument(argument, "--config=", value)) {
+    // the configuration file has already been read.
+  } else if (argument == "--no-gpu-profiler") {
+    sUseGpuProfiler = false;
+  } else if (argument == "--no-capability-cache") {
+    sUseCapabilitySnapshot = false;
+  } else if (argument == "--no-host-allocator") {
+    sUseHostAllocator = false;
+  } else if (match_argument(argument, "--host-memory-budget=", value)) {
+    sHostMemoryBudget = strtoull(value.c_str(), nullptr, 10) * 1024;
+  } else {
+    LOG_WARNING("Ignoring an unknown argument: %s\n", argument.c_str());
+  }
+}
+
+// ============================================================================
+// Read the arguments from a configuration file, where each line contains an
+// argument without the leading dashes (e.g. "layers=VK_LAYER_X"). The empty
+// lines and the lines starting with '#' are ignored.
+// @param path The path of the configuration file.
+// @param args The list where the arguments are appended.
+static void read_config_file(const std::string& path, std::vector<std::string>& args)
+{
+  auto file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    LOG_ERROR("Unable to open the configuration file: %s\n", path.c_str());
+    exit_failure();
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    std::string argument(line);
+    auto begin = argument.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos || argument[begin] == '#') {
+      continue;
+    }
+    auto end = argument.find_last_not_of(" \t\r\n");
+    args.push_back("--" + argument.substr(begin, end - begin + 1));
+  }
+  fclose(file);
+}
+
+// ============================================================================
+// Parse the configuration from the configuration file, from the environment and
+// from the command line, where the latter ones override the former ones.
+// @param args The command line arguments (excluding the program name).
+static void parse_command_line(const std::vector<std::string>& args)
+{
+  // the configuration file is used as defaults for everything else.
+  std::string configPath;
+  const char* config = getenv("SANDBOX_CONFIG");
+  if (config != nullptr) {
+    configPath = config;
+  }
+  for (const auto& argument : args) {
+    match_argument(argument, "--config=", configPath);
+  }
+  if (!configPath.empty()) {
+    std::vector<std::string> configArgs;
+    read_config_file(configPath, configArgs);
+    for (const auto& argument : configArgs) {
+      parse_argument(argument);
+    }
+  }
+
+  // environment variables are used as defaults for the command line.
+  const char* device = getenv("SANDBOX_DEVICE");
+  if (device != nullptr) {
+    sDeviceOverride = device;
+  }
+  const char* queuePriorities = getenv("SANDBOX_QUEUE_PRIORITIES");
+  if (queuePriorities != nullptr) {
+    parse_queue_priorities(queuePriorities);
+  }
+  const char* hostAllocator = getenv("SANDBOX_HOST_ALLOCATOR");
+  if (hostAllocator != nullptr && strcmp(hostAllocator, "0") == 0) {
+    sUseHostAllocator = false;
+  }
+  const char* hostMemoryBudget = getenv("SANDBOX_HOST_MEMORY_BUDGET");
+  if (hostMemoryBudget != nullptr) {
+    sHostMemoryBudget = strtoull(hostMemoryBudget, nullptr, 10) * 1024;
+  }
+  const char* presentMode = getenv("SANDBOX_PRESENT_MODE");
+  if (presentMode != nullptr) {
+    parse_present_mode(presentMode);
+  }
+  const char* deviceFeatures = getenv("SANDBOX_DEVICE_FEATURES");
+  if (deviceFeatures != nullptr) {
+    sRequestedDeviceFeatures = parse_device_features(deviceFeatures);
+  }
+  const char* requiredDeviceFeatures = getenv("SANDBOX_REQUIRED_DEVICE_FEATURES");
+  if (requiredDeviceFeatures != nullptr) {
+    sRequiredDeviceFeatures = parse_device_features(requiredDeviceFeatures);
+  }
+  const char* framesInFlight = getenv("SANDBOX_FRAMES_IN_FLIGHT");
+  if (framesInFlight != nullptr) {
+    parse_frames_in_flight(framesInFlight);
+  }
+  const char* recordingThreads = getenv("SANDBOX_RECORDING_THREADS");
+  if (recordingThreads != nullptr) {
+    sRecordingThreadCount = parse_thread_count(recordingThreads, "recording threads");
+  }
+  const char* jobWorkers = getenv("SANDBOX_JOB_WORKERS");
+  if (jobWorkers != nullptr) {
+    sRequestedJobWorkerCount = parse_thread_count(jobWorkers, "job workers");
+  }
+  const char* draws = getenv("SANDBOX_DRAWS");
+  if (draws != nullptr) {
+    sDrawCount = static_cast<uint32_t>(strtoul(draws, nullptr, 10));
+  }
+  const char* gpuProfiler = getenv("SANDBOX_GPU_PROFILER");
+  if (gpuProfiler != nullptr && strcmp(gpuProfiler, "0") == 0) {
+    sUseGpuProfiler = false;
+  }
+  const char* capabilityCache = getenv("SANDBOX_CAPABILITY_CACHE");
+  if (capabilityCache != nullptr && strcmp(capabilityCache, "0") == 0) {
+    sUseCapabilitySnapshot = false;
+  }
+  const char* validation = getenv("SANDBOX_VALIDATION");
+  if (validation != nullptr && strcmp(validation, "") != 0) {
+    sUseValidation = strcmp(validation, "0") != 0;
+  }
+  const char* bestPractices = getenv("SANDBOX_BEST_PRACTICES");
+  if (bestPractices != nullptr && strcmp(bestPractices, "") != 0 && strcmp(bestPractices, "0") != 0) {
+    sUseValidation = true;
+    sUseBestPractices = true;
+  }
+  const char* layers = getenv("SANDBOX_LAYERS");
+  if (layers != nullptr) {
+    split_names(layers, sRequestedLayers);
+  }
+  const char* instanceExtensions = getenv("SANDBOX_INSTANCE_EXTENSIONS");
+  if (instanceExtensions != nullptr) {
+    split_names(instanceExtensions, sRequestedInstanceExtensions);
+  }
+  const char* trace = getenv("SANDBOX_TRACE");
+  if (trace != nullptr && strcmp(trace, "") != 0) {
+    sUseTrace = true;
+    sTracePath = trace;
+  }
+  const char* headless = getenv("SANDBOX_HEADLESS");
+  if (headless != nullptr && strcmp(headless, "") != 0 && strcmp(headless, "0") != 0) {
+    sHeadless = true;
+  }
+
+  for (const auto& argument : args) {
+    parse_argument(argument);
+  }
+}
+
+#ifdef _WIN32
+// ============================================================================
+// Split the command line into whitespace separated arguments.
+// @param commandLine The command line arguments as a single string.
+// @returns The list of arguments.
+static std::vector<std::string> split_command_line(const char* commandLine)
+{
+  std::vector<std::string> args;
+  std::string arg;
+  for (const char* c = commandLine; c != nullptr && *c != '\0'; c++) {
+    if (*c == ' ' || *c == '\t') {
+      if (!arg.empty()) {
+        args.push_back(arg);
+        arg.clear();
+      }
+    } else {
+      arg += *c;
+    }
+  }
+  if (!arg.empty()) {
+    args.push_back(arg);
+  }
+  return args;
+}
+#endif
+
+// ============================================================================
+// INITIALIZATION TASKS
+// ============================================================================
+// The initialization is described as a graph of tasks, where each task runs as
+// soon as all of its dependencies are done. The tasks are jobs that signal
+// their own counters and depend on the counters of their dependencies (see
+// JOBS), so the tasks without dependencies on each other run concurrently on
+// the job workers, e.g. the window is created while the Vulkan instance is
+// being created and the render targets, frames and the pipeline cache are
+// created at the same time once the device exists.
+//
+//   load_vulkan_library
+//     |
+//     v
+//   load_capability_snapshot
+//     |
+//     v
+//   enumerate_layers_and_extensions
+//     |
+//     +--> create_instance ----------------.
+//     |                                    +--> create_window_surface
+//     |    init_window --------------------'            |
+//     |                                                 v
+//     |                                      select_physical_device
+//     |                                                 |
+//     '--> save_capability_snapshot <-------------------+
+//                                                       |
+//                                                       v
+//                                              create_logical_device
+//                                                       |
+//            .------------------+-----------------------+-------------------.
+//            v                  v                       v                   v
+//   create_pipeline_cache  create_render_targets  create_frames  create_gpu_profiler
+//
+// The window tasks run on the main thread, as a window belongs to the thread
+// that created it and its messages are only delivered to that thread. They're
+// skipped in headless mode.
+// ============================================================================
+
+// The identifiers of the initialization tasks.
+enum InitTaskId
+{
+  INIT_TASK_WINDOW,
+  INIT_TASK_LIBRARY,
+  INIT_TASK_CAPABILITY_SNAPSHOT,
+  INIT_TASK_LAYERS_AND_EXTENSIONS,
+  INIT_TASK_INSTANCE,
+  INIT_TASK_WINDOW_SURFACE,
+  INIT_TASK_PHYSICAL_DEVICE,
+  INIT_TASK_SAVE_CAPABILITY_SNAPSHOT,
+  INIT_TASK_LOGICAL_DEVICE,
+  INIT_TASK_PIPELINE_CACHE,
+  INIT_TASK_RENDER_TARGETS,
+  INIT_TASK_FRAMES,
+  INIT_TASK_GPU_PROFILER,
+  INIT_TASK_COUNT
+};
+
+// A task of the initialization.
+struct InitTask
+{
+  const char* name;
+  void        (*function)();
+  uint32_t    dependencies;
+  bool        window;
+};
+
+#define INIT_TASK_BIT(id) (1u << (id))
+
+// ============================================================================
+// Create the window unless it already exists from a previous initialization.
+static void init_window_task()
+{
+#ifdef _WIN32
+  if (sHWND == nullptr) {
+    init_window();
+  }
+#endif
+}
+
+// ============================================================================
+
+static void create_window_surface_task()
+{
+#ifdef _WIN32
+  create_window_surface();
+#endif
+}
+
+// The initialization tasks and their dependencies.
+static const InitTask INIT_TASKS[INIT_TASK_COUNT] = {
+  { "init_window", init_window_task, 0, true },
+  { "load_vulkan_library", load_vulkan_library, 0, false },
+  { "load_capability_snapshot", load_capability_snapshot, INIT_TASK_BIT(INIT_TASK_LIBRARY), false },
+  { "enumerate_layers_and_extensions", enumerate_instance_layers_and_extensions, INIT_TASK_BIT(INIT_TASK_CAPABILITY_SNAPSHOT), false },
+  { "create_instance", create_instance, INIT_TASK_BIT(INIT_TASK_LAYERS_AND_EXTENSIONS), false },
+  { "create_window_surface", create_window_surface_task, INIT_TASK_BIT(INIT_TASK_WINDOW) | INIT_TASK_BIT(INIT_TASK_INSTANCE), true },
+  { "select_physical_device", select_vulkan_physical_device_and_queue_family, INIT_TASK_BIT(INIT_TASK_CAPABILITY_SNAPSHOT) | INIT_TASK_BIT(INIT_TASK_WINDOW_SURFACE), false },
+  { "save_capability_snapshot", save_capability_snapshot, INIT_TASK_BIT(INIT_TASK_LAYERS_AND_EXTENSIONS) | INIT_TASK_BIT(INIT_TASK_PHYSICAL_DEVICE), false },
+  { "create_logical_device", create_logical_device, INIT_TASK_BIT(INIT_TASK_PHYSICAL_DEVICE), false },
+  { "create_pipeline_cache", create_pipeline_cache, INIT_TASK_BIT(INIT_TASK_LOGICAL_DEVICE), false },
+  { "create_render_targets", create_render_targets, INIT_TASK_BIT(INIT_TASK_LOGICAL_DEVICE), false },
+  { "create_frames", create_frames, INIT_TASK_BIT(INIT_TASK_LOGICAL_DEVICE), false },
+  { "create_gpu_profiler", create_gpu_profiler, INIT_TASK_BIT(INIT_TASK_LOGICAL_DEVICE), false }
+};
+
+// ============================================================================
+// Run an initialization task and record the duration of its startup phase.
+// @param id The identifier of the task.
+static void run_init_task(int id)
+{
+  const auto& task = INIT_TASKS[id];
+  if (task.window && sHeadless) {
+    return;
+  }
+  auto startTime = std::chrono::steady_clock::now();
+  {
+    HostMemoryPhase phase(task.name);
+    TraceZone zone(task.name);
+    task.function();
+  }
+  startup_phase(task.name, milliseconds_since(startTime));
+}
+
+// ============================================================================
+// Run the initialization tasks in the order of their dependencies and return
+// when all of the tasks are done.
+static void init_vulkan()
+{
+  JobCounter counters[INIT_TASK_COUNT];
+  JobCounter* dependencies[INIT_TASK_COUNT][INIT_TASK_COUNT] = {};
+  uint32_t dependencyCounts[INIT_TASK_COUNT] = {};
+  for (int id = 0; id < INIT_TASK_COUNT; id++) {
+    // the tasks are listed in the order of their dependencies.
+    assert(INIT_TASKS[id].dependencies < INIT_TASK_BIT(id));
+    for (int dependency = 0; dependency < id; dependency++) {
+      if ((INIT_TASKS[id].dependencies & INIT_TASK_BIT(dependency)) != 0) {
+        dependencies[id][dependencyCounts[id]++] = &counters[dependency];
+      }
+    }
+  }
+
+  // the window tasks are pending until the main thread has run them.
+  for (int id = 0; id < INIT_TASK_COUNT; id++) {
+    if (INIT_TASKS[id].window) {
+      job_counter_add(counters[id], 1);
+    }
+  }
+  for (int id = 0; id < INIT_TASK_COUNT; id++) {
+    if (INIT_TASKS[id].window) {
+      continue;
+    }
+    run_job([id] { run_init_task(id); }, &counters[id], dependencies[id], dependencyCounts[id]);
+  }
+
+  // run the window tasks on the main thread as soon as their dependencies are done.
+  for (int id = 0; id < INIT_TASK_COUNT; id++) {
+    if (!INIT_TASKS[id].window) {
+      continue;
+    }
+    for (uint32_t i = 0; i < dependencyCounts[id]; i++) {
+      wait_for_counter(*dependencies[id][i]);
+    }
+    run_init_task(id);
+    job_counter_done(counters[id]);
+  }
+  for (auto& counter : counters) {
+    wait_for_counter(counter);
+  }
+}
 
 // ============================================================================
 
 static void init()
 {
-  init_window();
+  trace_thread_name("main");
+  TraceZone zone("init");
+  begin_startup_phases();
+  init_host_allocator();
   init_vulkan();
+  drain_debug_messages();
+  end_startup_phases();
+  print_startup_phases();
+  LOG_INFO("Initialization completed in %.3f ms after startup.\n", milliseconds_since(sStartupTime));
+}
+
+// ============================================================================
+// Render frames until the window is closed or the frame limit is reached. The
+// window messages are drained without blocking, so that a new frame can be
+// rendered as soon as a frame in flight becomes available.
+static void run_frame_loop()
+{
+  // without a window there's no way to stop an unlimited loop.
+  if (sHeadless && sFrameLimit == 0) {
+    return;
+  }
+
+  auto startTime = std::chrono::steady_clock::now();
+  auto running = true;
+  while (running && (sFrameLimit == 0 || sFrameNumber < sFrameLimit)) {
+#ifdef _WIN32
+    if (!sHeadless) {
+      MSG msg;
+      while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+        if (msg.message == WM_QUIT) {
+          running = false;
+        }
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+      }
+      // there's nothing to render into while the window is minimized.
+      if (running && sWindowMinimized) {
+        WaitMessage();
+        continue;
+      }
+    }
+#endif
+    if (running) {
+      render_frame();
+      if (sFrameNumber == 1) {
+        LOG_INFO("First frame submitted %.3f ms after startup.\n", milliseconds_since(sStartupTime));
+      }
+    }
+  }
+
+  auto milliseconds = milliseconds_since(startTime);
+  LOG_INFO("Rendered [%llu] frames in %.3f ms (%.3f ms per frame).\n",
+    static_cast<unsigned long long>(sFrameNumber),
+    milliseconds,
+    sFrameNumber > 0 ? milliseconds / sFrameNumber : 0.0);
+
+  // collect the zones of the frames that are still in flight.
+  vkDeviceWaitIdle(sLogicalDevice);
+  for (uint32_t i = 0; i < sFramesInFlight; i++) {
+    gpu_profiler_collect(i);
+  }
+  print_gpu_profiler_statistics();
+}
+
+// ============================================================================
+// Repeat the Vulkan initialization and the first frame and print the timings.
+// The host allocator and the window are only created by the first run.
+static void benchmark_startup()
+{
+  trace_thread_name("main");
+  init_host_allocator();
+  for (uint32_t i = 0; i < sBenchStartupCount; i++) {
+    TraceZone zone("startup");
+    begin_startup_phases();
+    init_vulkan();
+    auto startTime = std::chrono::steady_clock::now();
+    render_frame();
+    vkDeviceWaitIdle(sLogicalDevice);
+    startup_phase("first_frame", milliseconds_since(startTime));
+    end_startup_phases();
+    destroy_vulkan();
+  }
+  print_startup_benchmark();
 }
 
 // ============================================================================
 
+#ifdef _WIN32
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
 {
+  sStartupTime = std::chrono::steady_clock::now();
+  start_log();
+  atexit(stop_log);
+  parse_command_line(split_command_line(lpCmdLine));
+  start_job_system();
   atexit(shutdown);
+  if (sBenchStartupCount > 0) {
+    benchmark_startup();
+    return 0;
+  }
   init();
+  if (sBenchDeviceMemory) {
+    benchmark_device_memory();
+    return 0;
+  }
+  if (sBenchRecording) {
+    benchmark_recording();
+    return 0;
+  }
 
-  MSG msg;
-  ShowWindow(sHWND, nCmdShow);
-  UpdateWindow(sHWND);
-  while (GetMessage(&msg, NULL, 0, 0) > 0) {
-    TranslateMessage(&msg);
-    DispatchMessage(&msg);
+  if (!sHeadless) {
+    ShowWindow(sHWND, nCmdShow);
+    UpdateWindow(sHWND);
   }
+  run_frame_loop();
 
-  printf("%d %d %s %d\n", hInstance->unused, hPrevInstance->unused, lpCmdLine, nCmdShow);
+  LOG_INFO("%d %d %s %d\n", hInstance->unused, hPrevInstance->unused, lpCmdLine, nCmdShow);
 
   return 0;
 }
+#else
+int main(int argc, char** argv)
+{
+  sStartupTime = std::chrono::steady_clock::now();
+  start_log();
+  atexit(stop_log);
+  parse_command_line(std::vector<std::string>(argv + 1, argv + argc));
+  start_job_system();
+  atexit(shutdown);
+  if (sBenchStartupCount > 0) {
+    benchmark_startup();
+    return 0;
+  }
+  init();
+  if (sBenchDeviceMemory) {
+    benchmark_device_memory();
+    return 0;
+  }
+  if (sBenchRecording) {
+    benchmark_recording();
+    return 0;
+  }
+  run_frame_loop();
+  return 0;
+}
+#endif